@@ -0,0 +1,420 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ *
+ *  Drives the read_only API of mongo_history_plugin from worker threads and prints the throughput and
+ *  latency percentiles of every case as one json line. History comes from history-backend = memory
+ *  unless --backend says otherwise, arguments after -- are passed on to the plugins.
+ */
+#include <eosio/mongo_history_plugin/mongo_history_plugin.hpp>
+#include <eosio/mongo_history_plugin/action_trace_filter.hpp>
+#include <eosio/mongo_history_plugin/compact_schema.hpp>
+#include <eosio/mongo_history_plugin/history_documents.hpp>
+#include <eosio/mongo_history_plugin/latency_histogram.hpp>
+#include <eosio/mongo_history_plugin/synthetic_history.hpp>
+#include <eosio/chain_plugin/chain_plugin.hpp>
+
+#include <appbase/application.hpp>
+
+#include <fc/io/json.hpp>
+#include <fc/variant_object.hpp>
+
+#include <mongocxx/client.hpp>
+#include <mongocxx/instance.hpp>
+#include <mongocxx/uri.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <thread>
+
+using namespace appbase;
+using namespace eosio;
+
+namespace {
+
+namespace bpo = boost::program_options;
+namespace bfs = boost::filesystem;
+
+using read_only = mongo_history_apis::read_only;
+
+struct benchmark_config {
+   uint32_t                   requests = 100000;
+   uint32_t                   threads = 4;
+   std::vector<std::string>   cases;
+   std::string                backend;
+   std::string                mongodb_uri;
+   bool                       load = false;
+   bool                       compact = false;
+   synthetic_history_config   synthetic;
+};
+
+/// spreads requests over the whole range of n, the same request index always picks the same item
+uint32_t pick( uint32_t request, uint32_t n ) {
+   return uint32_t( (uint64_t( request ) * 2654435761u) % std::max<uint32_t>( 1, n ) );
+}
+
+/**
+ *  Calls f( i ) for i in [0, requests) from threads workers and records the latency of every call.
+ *  f returns the number of items in its result, a call that throws is counted as an error.
+ */
+fc::mutable_variant_object run_case( const std::string& name, const benchmark_config& cfg,
+                                     const std::function<uint64_t( uint32_t )>& f ) {
+   latency_histogram latency;
+   std::atomic<uint32_t> next{0};
+   std::atomic<uint64_t> returned{0};
+   std::atomic<uint64_t> errors{0};
+
+   const auto start = std::chrono::steady_clock::now();
+   std::vector<std::thread> workers;
+   for( uint32_t t = 0; t < std::max<uint32_t>( 1, cfg.threads ); ++t ) {
+      workers.emplace_back( [&]() {
+         for( uint32_t i = next++; i < cfg.requests; i = next++ ) {
+            const auto begin = std::chrono::steady_clock::now();
+            try {
+               returned += f( i );
+            } catch( const fc::exception& e ) {
+               if( errors++ == 0 ) wlog( "${c}: ${e}", ("c", name)("e", e.to_detail_string()) );
+            } catch( const std::exception& e ) {
+               if( errors++ == 0 ) wlog( "${c}: ${e}", ("c", name)("e", e.what()) );
+            }
+            latency.record( std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - begin ).count() );
+         }
+      } );
+   }
+   for( auto& w : workers ) w.join();
+   const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+   return fc::mutable_variant_object()
+         ("case", name)
+         ("threads", cfg.threads)
+         ("requests", cfg.requests)
+         ("errors", errors.load())
+         ("returned", returned.load())
+         ("per_second", uint64_t( cfg.requests / std::max( seconds, 1e-9 ) ))
+         ("latency", latency.get_summary());
+}
+
+/// a case prepares its requests, runs them with run_case and returns its result line
+using case_map = std::map<std::string, std::function<fc::mutable_variant_object( const benchmark_config& )>>;
+
+/// the read path cases, the ids, keys and accounts asked for are taken from the synthetic history
+case_map read_cases() {
+   case_map cases;
+
+   cases["actions"] = []( const benchmark_config& cfg ) {
+      const auto api = app().get_plugin<mongo_history_plugin>().get_read_only_api();
+      auto result = run_case( "actions", cfg, [&]( uint32_t i ) {
+         read_only::get_actions_params p;
+         p.account_name = synthetic_history::account( pick( i, cfg.synthetic.accounts ) );
+         p.pos = -1;
+         p.offset = -20;
+         return uint64_t( api.get_actions( p ).actions.size() );
+      } );
+      // what the plan read to answer, to compare history-mongodb-actions-query filter and aggregate
+      for( const auto& e : api.get_stats( read_only::get_stats_params() ).endpoints ) {
+         if( e.endpoint != "get_actions" ) continue;
+         result( "docs_scanned", e.docs_scanned )( "bytes_received", e.bytes_received );
+      }
+      return result;
+   };
+
+   // the busiest accounts of the zipf distribution, whose pages scan the most transaction_traces
+   cases["actions_top"] = []( const benchmark_config& cfg ) {
+      const auto api = app().get_plugin<mongo_history_plugin>().get_read_only_api();
+      return run_case( "actions_top", cfg, [&]( uint32_t i ) {
+         read_only::get_actions_params p;
+         p.account_name = synthetic_history::account( pick( i, std::min<uint32_t>( 10, cfg.synthetic.accounts ) ) );
+         p.pos = -1;
+         p.offset = -100;
+         return uint64_t( api.get_actions( p ).actions.size() );
+      } );
+   };
+
+   cases["accounts_actions"] = []( const benchmark_config& cfg ) {
+      const auto api = app().get_plugin<mongo_history_plugin>().get_read_only_api();
+      return run_case( "accounts_actions", cfg, [&]( uint32_t i ) {
+         read_only::get_accounts_actions_params p;
+         for( uint32_t a = 0; a < 10; ++a ) {
+            read_only::account_actions_page page;
+            page.account_name = synthetic_history::account( pick( i * 10 + a, cfg.synthetic.accounts ) );
+            page.offset = -20;
+            p.accounts.push_back( page );
+         }
+         uint64_t returned = 0;
+         for( const auto& r : api.get_accounts_actions( p ).accounts ) returned += r.actions.size();
+         return returned;
+      } );
+   };
+
+   cases["transaction"] = []( const benchmark_config& cfg ) {
+      std::vector<std::string> ids;
+      ids.reserve( cfg.synthetic.transactions );
+      synthetic_history( cfg.synthetic ).for_each_transaction( [&]( const chain::signed_transaction&,
+                                                                    const chain::transaction_trace& trace ) {
+         ids.emplace_back( trace.id.str() );
+      } );
+      const auto api = app().get_plugin<mongo_history_plugin>().get_read_only_api();
+      return run_case( "transaction", cfg, [&]( uint32_t i ) {
+         read_only::get_transaction_params p;
+         p.id = ids[pick( i, ids.size() )];
+         return uint64_t( api.get_transaction( p ).traces.size() );
+      } );
+   };
+
+   cases["keys"] = []( const benchmark_config& cfg ) {
+      std::vector<chain::public_key_type> keys;
+      synthetic_history( cfg.synthetic ).for_each_key( [&]( const chain::account_name&, const chain::permission_name& perm,
+                                                            const chain::public_key_type& key ) {
+         if( perm == N(owner) ) keys.push_back( key );
+      } );
+      const auto api = app().get_plugin<mongo_history_plugin>().get_read_only_api();
+      return run_case( "keys", cfg, [&]( uint32_t i ) {
+         read_only::get_key_accounts_params p;
+         p.public_key = keys[pick( i, keys.size() )];
+         return uint64_t( api.get_key_accounts( p ).account_names.size() );
+      } );
+   };
+
+   cases["controls"] = []( const benchmark_config& cfg ) {
+      std::vector<chain::account_name> controlling;
+      synthetic_history( cfg.synthetic ).for_each_control( [&]( const chain::account_name&, const chain::permission_name&,
+                                                                const chain::account_name& by ) {
+         controlling.push_back( by );
+      } );
+      const auto api = app().get_plugin<mongo_history_plugin>().get_read_only_api();
+      return run_case( "controls", cfg, [&]( uint32_t i ) {
+         read_only::get_controlled_accounts_params p;
+         p.controlling_account = controlling[pick( i, controlling.size() )];
+         return uint64_t( api.get_controlled_accounts( p ).controlled_accounts.size() );
+      } );
+   };
+
+   return cases;
+}
+
+/// transaction_traces documents of the first transactions of the synthetic history
+std::vector<bsoncxx::document::value> trace_documents( const benchmark_config& cfg, bool compact ) {
+   std::vector<bsoncxx::document::value> docs;
+   const bsoncxx::types::b_date created{ std::chrono::milliseconds( 0 ) };
+   auto synthetic = cfg.synthetic;
+   synthetic.transactions = std::min<uint32_t>( synthetic.transactions, 10000 );
+   synthetic_history( synthetic ).for_each_transaction( [&]( const chain::signed_transaction&,
+                                                             const chain::transaction_trace& trace ) {
+      docs.emplace_back( trace_document( trace, compact, created ) );
+   } );
+   return docs;
+}
+
+/// converting whole trace documents to variants, the former JSON round trip against from_bson
+case_map decode_cases() {
+   case_map cases;
+
+   cases["decode_json"] = []( const benchmark_config& cfg ) {
+      const auto docs = trace_documents( cfg, false );
+      return run_case( "decode_json", cfg, [&]( uint32_t i ) {
+         const auto v = fc::json::from_string( bsoncxx::to_json( docs[pick( i, docs.size() )].view() ) );
+         return uint64_t( v.get_object().size() );
+      } );
+   };
+
+   cases["decode"] = []( const benchmark_config& cfg ) {
+      const auto docs = trace_documents( cfg, false );
+      return run_case( "decode", cfg, [&]( uint32_t i ) {
+         const auto v = compact_schema::to_variant( docs[pick( i, docs.size() )].view(), false );
+         return uint64_t( v.get_object().size() );
+      } );
+   };
+
+   cases["decode_compact"] = []( const benchmark_config& cfg ) {
+      const auto docs = trace_documents( cfg, true );
+      return run_case( "decode_compact", cfg, [&]( uint32_t i ) {
+         const auto v = compact_schema::to_variant( docs[pick( i, docs.size() )].view(), true );
+         return uint64_t( v.get_object().size() );
+      } );
+   };
+
+   return cases;
+}
+
+/// transaction_traces documents matched per request by the filter cases
+const uint32_t filter_batch = 100;
+
+/// matching the action traces of filter_batch documents against one account
+case_map filter_cases() {
+   case_map cases;
+
+   // the former loop: top level traces only, every name copied to a string
+   cases["filter_alloc"] = []( const benchmark_config& cfg ) {
+      const auto docs = trace_documents( cfg, false );
+      return run_case( "filter_alloc", cfg, [&]( uint32_t i ) {
+         const auto name = synthetic_history::account( pick( i, cfg.synthetic.accounts ) ).to_string();
+         std::vector<bsoncxx::document::view> matches;
+         for( uint32_t d = 0; d < filter_batch; ++d ) {
+            for( auto trace : docs[pick( i + d, docs.size() )].view()["action_traces"].get_array().value ) {
+               auto trace_view = trace.get_document().view();
+               bool match = trace_view["receipt"]["receiver"].get_utf8().value.to_string() == name ||
+                            trace_view["act"]["account"].get_utf8().value.to_string() == name;
+               for( auto auth : trace_view["act"]["authorization"].get_array().value ) {
+                  if( auth["actor"].get_utf8().value.to_string() == name ) match = true;
+               }
+               if( match ) matches.push_back( trace_view );
+            }
+         }
+         return uint64_t( matches.size() );
+      } );
+   };
+
+   cases["filter"] = []( const benchmark_config& cfg ) {
+      const auto docs = trace_documents( cfg, false );
+      return run_case( "filter", cfg, [&]( uint32_t i ) {
+         const action_trace_filter filter( synthetic_history::account( pick( i, cfg.synthetic.accounts ) ) );
+         std::vector<bsoncxx::document::view> matches;
+         matches.reserve( filter_batch );
+         for( uint32_t d = 0; d < filter_batch; ++d ) {
+            filter.collect( docs[pick( i + d, docs.size() )].view()["action_traces"].get_array().value, matches,
+                            std::numeric_limits<size_t>::max() );
+         }
+         return uint64_t( matches.size() );
+      } );
+   };
+
+   return cases;
+}
+
+/// replaces transactions and transaction_traces in the database of cfg.mongodb_uri with the synthetic history
+void load_mongodb( const benchmark_config& cfg ) {
+   mongocxx::instance::current();
+   const mongocxx::uri uri{ cfg.mongodb_uri };
+   mongocxx::client client{ uri };
+   auto db = client[uri.database().empty() ? "EOS" : uri.database()];
+   auto trans = db["transactions"];
+   auto trans_traces = db["transaction_traces"];
+   trans.drop();
+   trans_traces.drop();
+
+   const bsoncxx::types::b_date created{ std::chrono::milliseconds( 0 ) };
+   std::vector<bsoncxx::document::value> trx_docs;
+   std::vector<bsoncxx::document::value> trace_docs;
+   auto flush = [&]() {
+      if( !trx_docs.empty() ) trans.insert_many( trx_docs );
+      if( !trace_docs.empty() ) trans_traces.insert_many( trace_docs );
+      trx_docs.clear();
+      trace_docs.clear();
+   };
+   uint32_t loaded = 0;
+   synthetic_history( cfg.synthetic ).for_each_transaction( [&]( const chain::signed_transaction& trx,
+                                                                 const chain::transaction_trace& trace ) {
+      trx_docs.emplace_back( transaction_document( trx, trace.id, true, false, false, created ) );
+      trace_docs.emplace_back( trace_document( trace, cfg.compact, created ) );
+      if( trace_docs.size() >= 1000 ) flush();
+      if( ++loaded % 100000 == 0 ) ilog( "loaded ${n} transactions", ("n", loaded) );
+   } );
+   flush();
+   ilog( "loaded ${n} transactions into ${db}", ("n", loaded)("db", db.name().to_string()) );
+}
+
+} // namespace
+
+int main( int argc, char** argv ) {
+   try {
+      benchmark_config cfg;
+      bpo::options_description desc( "mongo_history_benchmark [options] [-- plugin options]" );
+      desc.add_options()
+         ("help,h", "Print this help")
+         ("cases", bpo::value<std::vector<std::string>>( &cfg.cases )->multitoken()
+                      ->default_value( { "actions", "accounts_actions", "transaction", "keys", "controls" },
+                                       "actions accounts_actions transaction keys controls" ),
+          "Cases to run, in order")
+         ("requests", bpo::value<uint32_t>( &cfg.requests )->default_value( cfg.requests ), "Requests per case")
+         ("threads", bpo::value<uint32_t>( &cfg.threads )->default_value( cfg.threads ), "Worker threads sending requests")
+         ("backend", bpo::value<std::string>( &cfg.backend )->default_value( "memory" ),
+          "history-backend to read from, with mongodb the history is expected to match the synthetic options")
+         ("mongodb-uri", bpo::value<std::string>( &cfg.mongodb_uri ), "history-mongodb-uri")
+         ("load", bpo::bool_switch( &cfg.load ), "Replace the history in mongodb-uri with the synthetic history first")
+         ("compact", bpo::bool_switch( &cfg.compact ), "Load the compact schema")
+         ("transactions", bpo::value<uint32_t>( &cfg.synthetic.transactions )->default_value( cfg.synthetic.transactions ),
+          "history-synthetic-transactions")
+         ("accounts", bpo::value<uint32_t>( &cfg.synthetic.accounts )->default_value( cfg.synthetic.accounts ),
+          "history-synthetic-accounts")
+         ("skew", bpo::value<double>( &cfg.synthetic.skew )->default_value( cfg.synthetic.skew ), "history-synthetic-skew")
+         ("seed", bpo::value<uint64_t>( &cfg.synthetic.seed )->default_value( cfg.synthetic.seed ), "history-synthetic-seed");
+
+      int own_argc = argc;
+      for( int i = 1; i < argc; ++i ) {
+         if( std::string( argv[i] ) == "--" ) {
+            own_argc = i;
+            break;
+         }
+      }
+      bpo::variables_map vmap;
+      bpo::store( bpo::parse_command_line( own_argc, argv, desc ), vmap );
+      bpo::notify( vmap );
+      if( vmap.count( "help" ) ) {
+         std::cout << desc << std::endl;
+         return 0;
+      }
+
+      auto cases = read_cases();
+      for( auto& c : decode_cases() ) cases.insert( std::move( c ) );
+      for( auto& c : filter_cases() ) cases.insert( std::move( c ) );
+      for( const auto& c : cfg.cases ) {
+         if( !cases.count( c ) ) {
+            std::cerr << "unknown case " << c << std::endl;
+            return 1;
+         }
+      }
+
+      if( cfg.load ) {
+         if( cfg.mongodb_uri.empty() ) {
+            std::cerr << "--load needs --mongodb-uri" << std::endl;
+            return 1;
+         }
+         load_mongodb( cfg );
+      }
+
+      const auto dir = bfs::temp_directory_path() / bfs::unique_path( "mongo-history-benchmark-%%%%-%%%%" );
+      std::vector<std::string> args{ argv[0],
+            "--data-dir", (dir / "data").string(), "--config-dir", (dir / "config").string(),
+            "--history-backend", cfg.backend,
+            "--history-synthetic-transactions", std::to_string( cfg.synthetic.transactions ),
+            "--history-synthetic-accounts", std::to_string( cfg.synthetic.accounts ),
+            "--history-synthetic-skew", std::to_string( cfg.synthetic.skew ),
+            "--history-synthetic-seed", std::to_string( cfg.synthetic.seed ) };
+      if( !cfg.mongodb_uri.empty() ) {
+         args.emplace_back( "--history-mongodb-uri" );
+         args.emplace_back( cfg.mongodb_uri );
+      }
+      for( int i = own_argc + 1; i < argc; ++i ) args.emplace_back( argv[i] );
+      std::vector<char*> app_argv;
+      for( auto& a : args ) app_argv.push_back( &a[0] );
+
+      int result = 0;
+      if( app().initialize<chain_plugin, mongo_history_plugin>( int( app_argv.size() ), app_argv.data() ) ) {
+         app().startup();
+         for( const auto& c : cfg.cases ) {
+            std::cout << fc::json::to_string( cases[c]( cfg ) ) << std::endl;
+         }
+         app().quit();
+         app().exec();
+      } else {
+         result = 1;
+      }
+      bfs::remove_all( dir );
+      return result;
+   } catch( const fc::exception& e ) {
+      elog( "${e}", ("e", e.to_detail_string()) );
+   } catch( const boost::exception& e ) {
+      elog( "${e}", ("e", boost::diagnostic_information( e )) );
+   } catch( const std::exception& e ) {
+      elog( "${e}", ("e", e.what()) );
+   }
+   return 1;
+}
@@ -0,0 +1,71 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/mongo_history_plugin/compact_schema.hpp>
+
+#include <eosio/chain/name.hpp>
+
+#include <bsoncxx/array/view.hpp>
+#include <bsoncxx/document/element.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/stdx/string_view.hpp>
+
+#include <string>
+#include <vector>
+
+namespace eosio {
+
+/**
+ *  Matches action traces against one account without allocating: names are compared as string views
+ *  into the BSON buffer, or as integers in the compact schema. A trace matches if the account is its
+ *  receiver, its contract or one of its authorizers; inline traces are evaluated as well since the
+ *  transaction_traces query selects on them.
+ */
+class action_trace_filter {
+   public:
+      explicit action_trace_filter( const chain::account_name& n )
+      :account( n ), name_str( n.to_string() ), target( name_str ) {}
+
+      bool matches( const bsoncxx::document::view& trace )const {
+         if( equals( trace["receipt"]["receiver"] ) || equals( trace["act"]["account"] ) )
+            return true;
+         auto auths = trace["act"]["authorization"];
+         if( auths && auths.type() == bsoncxx::type::k_array ) {
+            for( auto auth : auths.get_array().value ) {
+               if( equals( auth["actor"] ) ) return true;
+            }
+         }
+         return false;
+      }
+
+      /// appends matching traces in execution order until out holds limit entries
+      void collect( const bsoncxx::array::view& traces, std::vector<bsoncxx::document::view>& out, size_t limit )const {
+         for( auto trace : traces ) {
+            if( out.size() >= limit ) return;
+            collect( trace.get_document().view(), out, limit );
+         }
+      }
+
+      /// appends the trace and its matching inline traces until out holds limit entries
+      void collect( const bsoncxx::document::view& trace, std::vector<bsoncxx::document::view>& out, size_t limit )const {
+         if( out.size() >= limit ) return;
+         if( matches( trace ) ) out.push_back( trace );
+         auto inlines = trace["inline_traces"];
+         if( inlines && inlines.type() == bsoncxx::type::k_array )
+            collect( inlines.get_array().value, out, limit );
+      }
+
+   private:
+      bool equals( const bsoncxx::document::element& ele )const {
+         return compact_schema::name_equals( ele, account, target );
+      }
+
+      chain::account_name         account;
+      std::string                 name_str;
+      bsoncxx::stdx::string_view  target;
+};
+
+} // namespace eosio
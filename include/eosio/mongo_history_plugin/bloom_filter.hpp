@@ -0,0 +1,84 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+namespace eosio {
+
+/**
+ *  Bloom filter over 64 bit values that is written and read concurrently: bits are set with a relaxed
+ *  atomic or, so a value added by one thread is found by every later lookup. contains() never misses
+ *  a value that was added and is wrong for about false_positive_rate of the others while fewer than
+ *  capacity distinct values have been added, more only raise that rate.
+ */
+class bloom_filter {
+   public:
+      bloom_filter( uint64_t capacity, double false_positive_rate ) {
+         const double ln2 = std::log( 2.0 );
+         const double bits = -double( std::max<uint64_t>( capacity, 1 ) ) * std::log( false_positive_rate ) / (ln2 * ln2);
+         word_count = std::max<uint64_t>( 1, uint64_t( bits / 64 ) + 1 );
+         hashes = uint32_t( std::min( 16.0, std::max( 1.0, std::round( bits / std::max<uint64_t>( capacity, 1 ) * ln2 ) ) ) );
+         words.reset( new std::atomic<uint64_t>[word_count] );
+         for( uint64_t i = 0; i < word_count; ++i ) words[i] = 0;
+      }
+
+      void add( uint64_t v ) {
+         uint64_t h1, h2;
+         hash( v, h1, h2 );
+         for( uint32_t i = 0; i < hashes; ++i ) {
+            const uint64_t bit = (h1 + i * h2) % bit_count();
+            words[bit / 64].fetch_or( uint64_t( 1 ) << (bit % 64), std::memory_order_relaxed );
+         }
+      }
+
+      bool contains( uint64_t v )const {
+         uint64_t h1, h2;
+         hash( v, h1, h2 );
+         for( uint32_t i = 0; i < hashes; ++i ) {
+            const uint64_t bit = (h1 + i * h2) % bit_count();
+            if( !(words[bit / 64].load( std::memory_order_relaxed ) & (uint64_t( 1 ) << (bit % 64))) ) return false;
+         }
+         return true;
+      }
+
+      uint64_t bit_count()const { return word_count * 64; }
+      uint32_t hash_count()const { return hashes; }
+
+      /// distinct values added, estimated from the share of bits set
+      uint64_t estimated_size()const {
+         uint64_t set = 0;
+         for( uint64_t i = 0; i < word_count; ++i ) {
+            set += uint64_t( __builtin_popcountll( words[i].load( std::memory_order_relaxed ) ) );
+         }
+         if( set >= bit_count() ) return bit_count();
+         return uint64_t( -double( bit_count() ) / hashes * std::log( 1.0 - double( set ) / bit_count() ) + 0.5 );
+      }
+
+   private:
+      /// two independent hashes of v, combined as h1 + i * h2 for the i-th probe
+      static void hash( uint64_t v, uint64_t& h1, uint64_t& h2 ) {
+         h1 = mix( v );
+         h2 = mix( h1 ) | 1;
+      }
+
+      /// splitmix64 finalizer, account names differ mostly in their high bits
+      static uint64_t mix( uint64_t z ) {
+         z += 0x9e3779b97f4a7c15ULL;
+         z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+         z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+         return z ^ (z >> 31);
+      }
+
+      std::unique_ptr<std::atomic<uint64_t>[]>  words;
+      uint64_t                                  word_count = 0;
+      uint32_t                                  hashes = 1;
+};
+
+} // namespace eosio
@@ -0,0 +1,112 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <bsoncxx/array/view.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+#include <bsoncxx/types/value.hpp>
+
+#include <fc/crypto/base64.hpp>
+#include <fc/crypto/hex.hpp>
+#include <fc/io/json.hpp>
+#include <fc/variant.hpp>
+#include <fc/variant_object.hpp>
+
+namespace eosio {
+
+void from_bson( const bsoncxx::document::view& view, fc::mutable_variant_object& o );
+void from_bson( const bsoncxx::array::view& bson_array, fc::variants& a );
+
+/**
+ *  Converts a BSON value straight into an fc::variant without going through a JSON string.
+ *  The result is the same as fc::json::from_string( bsoncxx::to_json( ... ) ), types without a
+ *  JSON equivalent use the legacy extended JSON wrappers ($date, $oid, $binary, ...) that
+ *  bsoncxx::to_json produces.
+ */
+inline void from_bson( const bsoncxx::types::value& v, fc::variant& r ) {
+   using bsoncxx::type;
+   switch( v.type() ) {
+      case type::k_double:
+         r = v.get_double().value;
+         break;
+      case type::k_utf8:
+         r = v.get_utf8().value.to_string();
+         break;
+      case type::k_document: {
+         fc::mutable_variant_object o;
+         from_bson( v.get_document().value, o );
+         r = fc::variant( std::move( o ) );
+         break;
+      }
+      case type::k_array: {
+         fc::variants a;
+         from_bson( v.get_array().value, a );
+         r = fc::variant( std::move( a ) );
+         break;
+      }
+      case type::k_bool:
+         r = v.get_bool().value;
+         break;
+      case type::k_null:
+      case type::k_undefined:
+         r = fc::variant();
+         break;
+      case type::k_int32:
+         r = int64_t( v.get_int32().value );
+         break;
+      case type::k_int64:
+         r = int64_t( v.get_int64().value );
+         break;
+      case type::k_date:
+         r = fc::mutable_variant_object( "$date", int64_t( v.get_date().value.count() ) );
+         break;
+      case type::k_oid:
+         r = fc::mutable_variant_object( "$oid", v.get_oid().value.to_string() );
+         break;
+      case type::k_decimal128:
+         r = fc::mutable_variant_object( "$numberDecimal", v.get_decimal128().value.to_string() );
+         break;
+      case type::k_binary: {
+         const auto& b = v.get_binary();
+         uint8_t sub_type = static_cast<uint8_t>( b.sub_type );
+         r = fc::mutable_variant_object( "$binary", fc::base64_encode( b.bytes, b.size ) )
+                                       ( "$type", fc::to_hex( reinterpret_cast<const char*>( &sub_type ), 1 ) );
+         break;
+      }
+      default: {
+         // rare types (regex, timestamp, code, ...), let bsoncxx produce the extended JSON form
+         auto wrapped = bsoncxx::builder::basic::make_document( bsoncxx::builder::basic::kvp( "v", v ) );
+         r = fc::json::from_string( bsoncxx::to_json( wrapped.view() ) ).get_object()["v"];
+         break;
+      }
+   }
+}
+
+inline void from_bson( const bsoncxx::document::view& view, fc::mutable_variant_object& o ) {
+   for( auto ele : view ) {
+      fc::variant v;
+      from_bson( ele.get_value(), v );
+      o( ele.key().to_string(), std::move( v ) );
+   }
+}
+
+inline void from_bson( const bsoncxx::array::view& bson_array, fc::variants& a ) {
+   for( auto ele : bson_array ) {
+      a.emplace_back();
+      from_bson( ele.get_value(), a.back() );
+   }
+}
+
+inline fc::variant from_bson( const bsoncxx::document::view& view ) {
+   fc::mutable_variant_object o;
+   from_bson( view, o );
+   return fc::variant( std::move( o ) );
+}
+
+} // namespace eosio
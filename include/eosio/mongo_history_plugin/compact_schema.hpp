@@ -0,0 +1,222 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/mongo_history_plugin/bson.hpp>
+
+#include <eosio/chain/block_timestamp.hpp>
+#include <eosio/chain/name.hpp>
+
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/sub_array.hpp>
+#include <bsoncxx/builder/basic/sub_document.hpp>
+#include <bsoncxx/stdx/string_view.hpp>
+
+#include <fc/optional.hpp>
+
+namespace eosio { namespace compact_schema {
+
+/**
+ *  Schema versions of the documents in the history collections. mongo_db_plugin and the string
+ *  schema store names as strings and numbers as whatever JSON made of them. The compact schema
+ *  stores every account, action and permission name as the int64 value of the name, sequences
+ *  as int64 and block_time as a BSON date; its documents carry "schema": 2.
+ */
+const int32_t string_version  = 1;
+const int32_t compact_version = 2;
+
+/// top level documents without a schema field were written with strings
+inline bool is_compact( const bsoncxx::document::view& doc ) {
+   auto v = doc["schema"];
+   return v && v.type() == bsoncxx::type::k_int32 && v.get_int32().value >= compact_version;
+}
+
+/// fields holding a name, anywhere in a trace
+inline bool is_name_key( bsoncxx::stdx::string_view key ) {
+   return key == "receiver" || key == "account" || key == "name" || key == "actor" || key == "permission" ||
+          key == "controlled_account" || key == "controlled_permission" || key == "controlling_account";
+}
+
+inline bool is_time_key( bsoncxx::stdx::string_view key ) {
+   return key == "block_time";
+}
+
+/// the value of s if it is a name that converts back to s, exception names and the like are kept as strings
+inline fc::optional<uint64_t> to_name_value( const std::string& s ) {
+   if( s.empty() || s.size() > 12 ) return {};
+   for( char c : s ) {
+      if( !(c == '.' || (c >= '1' && c <= '5') || (c >= 'a' && c <= 'z')) ) return {};
+   }
+   chain::name n( s );
+   if( n.to_string() != s ) return {};
+   return n.value;
+}
+
+/// a name stored in either schema
+inline bool name_equals( const bsoncxx::document::element& ele, const chain::name& n, bsoncxx::stdx::string_view str ) {
+   if( !ele ) return false;
+   switch( ele.type() ) {
+      case bsoncxx::type::k_utf8:  return bsoncxx::stdx::string_view( ele.get_utf8().value ) == str;
+      case bsoncxx::type::k_int64: return uint64_t( ele.get_int64().value ) == n.value;
+      default:                     return false;
+   }
+}
+
+inline chain::name to_name( const bsoncxx::document::element& ele ) {
+   if( ele.type() == bsoncxx::type::k_int64 ) return chain::name( uint64_t( ele.get_int64().value ) );
+   return chain::name( ele.get_utf8().value.to_string() );
+}
+
+/// block_time stored as a date or, by mongo_db_plugin, as an ISO string
+inline chain::block_timestamp_type to_block_time( const bsoncxx::document::element& ele ) {
+   if( ele.type() == bsoncxx::type::k_date )
+      return chain::block_timestamp_type( fc::time_point( fc::milliseconds( ele.get_date().value.count() ) ) );
+   return chain::block_timestamp_type( fc::time_point::from_iso_string( ele.get_utf8().value.to_string() ) );
+}
+
+inline bsoncxx::types::b_date to_date( const chain::block_timestamp_type& t ) {
+   return bsoncxx::types::b_date{ std::chrono::milliseconds{ t.to_time_point().time_since_epoch().count() / 1000 } };
+}
+
+/// value of a name field in a query, both representations are matched while strings are still stored
+inline bsoncxx::document::value name_match( const chain::name& n, bool dual ) {
+   using bsoncxx::builder::basic::kvp;
+   using bsoncxx::builder::basic::make_array;
+   using bsoncxx::builder::basic::make_document;
+   if( !dual ) return make_document( kvp( "$eq", n.to_string() ) );
+   return make_document( kvp( "$in", make_array( n.to_string(), bsoncxx::types::b_int64{ int64_t( n.value ) } ) ) );
+}
+
+void to_bson( const fc::variant_object& o, bsoncxx::builder::basic::sub_document& doc );
+void to_bson( const fc::variants& a, bsoncxx::builder::basic::sub_array& arr );
+
+/**
+ *  Appends a value of a reflected chain object in the compact schema: unsigned integers become
+ *  int64, names under name fields int64 and block_time a date. Other values are stored as JSON would.
+ */
+template<typename Append>
+void append_value( Append&& append, bsoncxx::stdx::string_view key, const fc::variant& v ) {
+   using namespace bsoncxx::builder::basic;
+   switch( v.get_type() ) {
+      case fc::variant::null_type:
+         append( bsoncxx::types::b_null{} );
+         break;
+      case fc::variant::int64_type:
+         append( bsoncxx::types::b_int64{ v.as_int64() } );
+         break;
+      case fc::variant::uint64_type:
+         append( bsoncxx::types::b_int64{ int64_t( v.as_uint64() ) } );
+         break;
+      case fc::variant::double_type:
+         append( bsoncxx::types::b_double{ v.as_double() } );
+         break;
+      case fc::variant::bool_type:
+         append( bsoncxx::types::b_bool{ v.as_bool() } );
+         break;
+      case fc::variant::string_type: {
+         const auto& s = v.get_string();
+         if( is_name_key( key ) ) {
+            if( auto value = to_name_value( s ) ) {
+               append( bsoncxx::types::b_int64{ int64_t( *value ) } );
+               break;
+            }
+         } else if( is_time_key( key ) ) {
+            append( to_date( chain::block_timestamp_type( fc::time_point::from_iso_string( s ) ) ) );
+            break;
+         }
+         append( s );
+         break;
+      }
+      case fc::variant::array_type:
+         append( [&]( sub_array sub ) { to_bson( v.get_array(), sub ); } );
+         break;
+      case fc::variant::object_type:
+         append( [&]( sub_document sub ) { to_bson( v.get_object(), sub ); } );
+         break;
+      default:
+         append( v.as_string() );
+         break;
+   }
+}
+
+inline void to_bson( const fc::variant_object& o, bsoncxx::builder::basic::sub_document& doc ) {
+   for( const auto& e : o ) {
+      append_value( [&]( auto&& value ) { doc.append( bsoncxx::builder::basic::kvp( e.key(), std::forward<decltype(value)>( value ) ) ); },
+                    e.key(), e.value() );
+   }
+}
+
+inline void to_bson( const fc::variants& a, bsoncxx::builder::basic::sub_array& arr ) {
+   for( const auto& v : a ) {
+      // array elements have no field name, names inside arrays such as auth_sequence stay strings
+      append_value( [&]( auto&& value ) { arr.append( std::forward<decltype(value)>( value ) ); }, bsoncxx::stdx::string_view(), v );
+   }
+}
+
+void from_bson( const bsoncxx::document::view& view, fc::mutable_variant_object& o );
+void from_bson( const bsoncxx::array::view& bson_array, fc::variants& a );
+
+/**
+ *  Converts a compact document into the variant the string schema converts to, names and block_time
+ *  are turned back into strings. Only for documents that are_compact, int64 fields of the string
+ *  schema would be mistaken for names.
+ */
+inline void from_bson( const bsoncxx::types::value& v, bsoncxx::stdx::string_view key, fc::variant& r ) {
+   using bsoncxx::type;
+   switch( v.type() ) {
+      case type::k_int64:
+         if( is_name_key( key ) ) {
+            r = chain::name( uint64_t( v.get_int64().value ) ).to_string();
+            return;
+         }
+         break;
+      case type::k_date:
+         if( is_time_key( key ) ) {
+            r = fc::variant( chain::block_timestamp_type( fc::time_point( fc::milliseconds( v.get_date().value.count() ) ) ) );
+            return;
+         }
+         break;
+      case type::k_document: {
+         fc::mutable_variant_object o;
+         from_bson( v.get_document().value, o );
+         r = fc::variant( std::move( o ) );
+         return;
+      }
+      case type::k_array: {
+         fc::variants a;
+         from_bson( v.get_array().value, a );
+         r = fc::variant( std::move( a ) );
+         return;
+      }
+      default:
+         break;
+   }
+   eosio::from_bson( v, r );
+}
+
+inline void from_bson( const bsoncxx::document::view& view, fc::mutable_variant_object& o ) {
+   for( auto ele : view ) {
+      fc::variant v;
+      from_bson( ele.get_value(), ele.key(), v );
+      o( ele.key().to_string(), std::move( v ) );
+   }
+}
+
+inline void from_bson( const bsoncxx::array::view& bson_array, fc::variants& a ) {
+   for( auto ele : bson_array ) {
+      a.emplace_back();
+      from_bson( ele.get_value(), bsoncxx::stdx::string_view(), a.back() );
+   }
+}
+
+/// converts a trace or trace document of either schema
+inline fc::variant to_variant( const bsoncxx::document::view& view, bool compact ) {
+   if( !compact ) return eosio::from_bson( view );
+   fc::mutable_variant_object o;
+   from_bson( view, o );
+   return fc::variant( std::move( o ) );
+}
+
+} } // namespace eosio::compact_schema
@@ -0,0 +1,148 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/mongo_history_plugin/compact_schema.hpp>
+
+#include <eosio/chain/name.hpp>
+
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+
+#include <fc/optional.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace eosio {
+
+/**
+ *  Source of the documents the read_only API is answered from. Documents have the shapes of the
+ *  MongoDB collections of the same name, in either schema of compact_schema, so the conversion
+ *  and filtering code is the same whatever stores them. MongoDB specific plans (account_actions,
+ *  aggregation pipelines, partitioned scans) stay on the MongoDB backend.
+ */
+class history_backend {
+   public:
+      /// called for every document in turn, returning false stops the scan
+      using document_visitor = std::function<bool( const bsoncxx::document::view& )>;
+
+      /**
+       *  transaction_traces documents with a top level action trace involving account, or any of
+       *  accounts when that is not empty. Visited documents carry at least _id, schema and action_traces.
+       */
+      struct trace_scan {
+         chain::account_name                      account;
+         std::vector<chain::account_name>         accounts;
+         int32_t                                  sort = -1;   ///< by _id, 1 oldest first, -1 newest first
+         size_t                                   skip = 0;    ///< documents passed over before the first visited
+         fc::optional<bsoncxx::document::value>   from_id;     ///< {"id": _id}, the scan starts at this document
+         std::chrono::milliseconds                max_time{0}; ///< 0 is unlimited
+      };
+
+      virtual ~history_backend() {}
+
+      virtual void scan_traces( const trace_scan& scan, const document_visitor& visit )const = 0;
+
+      /**
+       *  transaction_traces documents whose id is id, or starts with it if it is shorter than a full
+       *  id, each with its transactions document joined as "trx": [ ... ]. At most limit are returned.
+       */
+      virtual std::vector<bsoncxx::document::value> find_transaction_traces( const std::string& id, size_t limit )const = 0;
+
+      /// calls f( account value ) for every account a trace_scan may find traces of, possibly more than once
+      virtual void for_each_trace_account( const std::function<void( uint64_t )>& f )const = 0;
+
+      /// calls f( account value ) once for every account with account_actions rows
+      virtual void for_each_action_account( const std::function<void( uint64_t )>& f )const = 0;
+
+      virtual void for_each_pub_key( const document_visitor& visit )const = 0;
+      virtual void for_each_account_control( const document_visitor& visit )const = 0;
+};
+
+/**
+ *  Calls f( account value ) for the names a trace_scan matches a transaction_traces document by:
+ *  receivers, authorizing actors and receivers of direct inline traces, as the MongoDB query does.
+ *  A name may be reported more than once.
+ */
+template<typename F>
+void for_each_scanned_account( const bsoncxx::document::view& trace, F&& f ) {
+   auto add = [&]( const bsoncxx::document::element& ele ) {
+      if( ele && (ele.type() == bsoncxx::type::k_utf8 || ele.type() == bsoncxx::type::k_int64) )
+         f( compact_schema::to_name( ele ).value );
+   };
+   auto action_traces = trace["action_traces"];
+   if( !action_traces || action_traces.type() != bsoncxx::type::k_array ) return;
+   for( auto at : action_traces.get_array().value ) {
+      add( at["receipt"]["receiver"] );
+      auto auths = at["act"]["authorization"];
+      if( auths && auths.type() == bsoncxx::type::k_array ) {
+         for( auto auth : auths.get_array().value ) add( auth["actor"] );
+      }
+      auto inlines = at["inline_traces"];
+      if( inlines && inlines.type() == bsoncxx::type::k_array ) {
+         for( auto inline_trace : inlines.get_array().value ) add( inline_trace["receipt"]["receiver"] );
+      }
+   }
+}
+
+/**
+ *  Calls visit( position ) for the union of the ascending position lists in sort order, each position
+ *  once, starting at from and after passing over skip of them; returning false stops. This is a
+ *  trace_scan of several accounts over per account lists of where their traces are.
+ */
+template<typename T, typename F>
+void scan_positions( const std::vector<const std::vector<T>*>& lists, int32_t sort, const fc::optional<T>& from,
+                     size_t skip, F&& visit ) {
+   // [lo, hi) of every list still to visit, taken from lo upwards or from hi downwards
+   struct range {
+      const std::vector<T>*  list;
+      size_t                 lo;
+      size_t                 hi;
+   };
+   std::vector<range> ranges;
+   for( auto l : lists ) {
+      auto lo = l->begin();
+      auto hi = l->end();
+      if( from ) {
+         if( sort > 0 ) lo = std::lower_bound( lo, hi, *from );
+         else hi = std::upper_bound( lo, hi, *from );
+      }
+      if( lo != hi ) ranges.push_back( { l, size_t( lo - l->begin() ), size_t( hi - l->begin() ) } );
+   }
+   auto head = [&]( size_t i ) -> const T& {
+      const auto& r = ranges[i];
+      return sort > 0 ? (*r.list)[r.lo] : (*r.list)[r.hi - 1];
+   };
+   // the range whose head comes next in sort order is on top
+   auto later = [&]( size_t a, size_t b ) { return sort > 0 ? head( b ) < head( a ) : head( a ) < head( b ); };
+   std::priority_queue<size_t, std::vector<size_t>, decltype( later )> queue( later );
+   for( size_t i = 0; i < ranges.size(); ++i ) queue.push( i );
+
+   fc::optional<T> last;
+   while( !queue.empty() ) {
+      const size_t i = queue.top();
+      queue.pop();
+      const T v = head( i );
+      auto& r = ranges[i];
+      if( sort > 0 ) ++r.lo;
+      else --r.hi;
+      if( r.lo != r.hi ) queue.push( i );
+      // a document involving several of the accounts is in several lists
+      if( last && *last == v ) continue;
+      last = v;
+      if( skip ) {
+         --skip;
+         continue;
+      }
+      if( !visit( v ) ) return;
+   }
+}
+
+} // namespace eosio
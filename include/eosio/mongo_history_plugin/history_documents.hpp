@@ -0,0 +1,55 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/mongo_history_plugin/compact_schema.hpp>
+
+#include <eosio/chain/trace.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+
+#include <fc/io/json.hpp>
+
+namespace eosio {
+
+/// a transactions document as mongo_db_plugin writes it
+inline bsoncxx::document::value transaction_document( const chain::signed_transaction& trx, const chain::transaction_id_type& id,
+                                                      bool accepted, bool implicit, bool scheduled,
+                                                      const bsoncxx::types::b_date& created ) {
+   using bsoncxx::builder::basic::kvp;
+   const auto value = bsoncxx::from_json( fc::json::to_string( trx ) );
+   bsoncxx::builder::basic::document doc;
+   doc.append( bsoncxx::builder::concatenate_doc{ value.view() } );
+   doc.append( kvp( "trx_id", id.str() ),
+               kvp( "accepted", bsoncxx::types::b_bool{ accepted } ),
+               kvp( "implicit", bsoncxx::types::b_bool{ implicit } ),
+               kvp( "scheduled", bsoncxx::types::b_bool{ scheduled } ),
+               kvp( "createdAt", created ) );
+   return doc.extract();
+}
+
+/// a transaction_traces document, in the compact schema when compact is set
+inline bsoncxx::document::value trace_document( const chain::transaction_trace& t, bool compact,
+                                                const bsoncxx::types::b_date& created ) {
+   using bsoncxx::builder::basic::kvp;
+   bsoncxx::builder::basic::document doc;
+   if( compact ) {
+      // straight from the reflected trace, no JSON round trip
+      doc.append( kvp( "schema", compact_schema::compact_version ) );
+      compact_schema::to_bson( fc::variant( t ).get_object(), doc );
+   } else {
+      const auto value = bsoncxx::from_json( fc::json::to_string( t ) );
+      doc.append( bsoncxx::builder::concatenate_doc{ value.view() } );
+   }
+   doc.append( kvp( "createdAt", created ) );
+   return doc.extract();
+}
+
+} // namespace eosio
@@ -0,0 +1,108 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <fc/reflect/reflect.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace eosio {
+
+/**
+ *  Lock free latency histogram in the style of HdrHistogram: values are bucketed by their power of
+ *  two and, within it, into sub_buckets linear steps, so percentiles are accurate to about 6% from
+ *  1us to more than an hour while recording is a single relaxed atomic increment.
+ */
+class latency_histogram {
+   public:
+      static const uint32_t sub_bucket_bits = 4;
+      static const uint32_t sub_buckets = 1 << sub_bucket_bits;
+      static const uint32_t magnitudes = 33;
+      static const uint32_t bucket_count = magnitudes * sub_buckets;
+
+      struct summary {
+         uint64_t count = 0;
+         uint64_t mean_us = 0;
+         uint64_t p50_us = 0;
+         uint64_t p90_us = 0;
+         uint64_t p99_us = 0;
+         uint64_t p999_us = 0;
+         uint64_t max_us = 0;
+      };
+
+      latency_histogram() {
+         for( auto& c : counts ) c = 0;
+      }
+
+      void record( int64_t us ) {
+         const uint64_t v = us > 0 ? uint64_t( us ) : 0;
+         counts[bucket_of( v )].fetch_add( 1, std::memory_order_relaxed );
+         total.fetch_add( 1, std::memory_order_relaxed );
+         sum.fetch_add( v, std::memory_order_relaxed );
+         uint64_t m = max.load( std::memory_order_relaxed );
+         while( v > m && !max.compare_exchange_weak( m, v, std::memory_order_relaxed ) ) {}
+      }
+
+      /// a consistent enough view while recording continues, counts are read once
+      summary get_summary()const {
+         std::array<uint64_t, bucket_count> snapshot;
+         uint64_t n = 0;
+         for( uint32_t i = 0; i < bucket_count; ++i ) {
+            snapshot[i] = counts[i].load( std::memory_order_relaxed );
+            n += snapshot[i];
+         }
+         summary s;
+         s.count = n;
+         if( n == 0 ) return s;
+         s.mean_us = sum.load( std::memory_order_relaxed ) / std::max<uint64_t>( 1, total.load( std::memory_order_relaxed ) );
+         s.max_us = max.load( std::memory_order_relaxed );
+         // bucket bounds may overshoot the largest value recorded
+         s.p50_us = std::min( s.max_us, percentile( snapshot, n, 0.5 ) );
+         s.p90_us = std::min( s.max_us, percentile( snapshot, n, 0.9 ) );
+         s.p99_us = std::min( s.max_us, percentile( snapshot, n, 0.99 ) );
+         s.p999_us = std::min( s.max_us, percentile( snapshot, n, 0.999 ) );
+         return s;
+      }
+
+   private:
+      /// values below sub_buckets are exact, larger ones keep sub_bucket_bits significant bits
+      static uint32_t bucket_of( uint64_t v ) {
+         if( v < sub_buckets ) return uint32_t( v );
+         const uint32_t magnitude = 63 - __builtin_clzll( v ) - sub_bucket_bits + 1;
+         if( magnitude >= magnitudes ) return bucket_count - 1;
+         const uint32_t sub = uint32_t( v >> (magnitude - 1) ) & (sub_buckets - 1);
+         return magnitude * sub_buckets + sub;
+      }
+
+      /// highest value that falls into bucket i
+      static uint64_t upper_bound_of( uint32_t i ) {
+         const uint32_t magnitude = i / sub_buckets;
+         const uint64_t sub = i % sub_buckets;
+         if( magnitude == 0 ) return sub;
+         return ((sub_buckets | sub) + 1) * (uint64_t( 1 ) << (magnitude - 1)) - 1;
+      }
+
+      static uint64_t percentile( const std::array<uint64_t, bucket_count>& snapshot, uint64_t n, double p ) {
+         const uint64_t rank = std::max<uint64_t>( 1, uint64_t( p * n + 0.5 ) );
+         uint64_t seen = 0;
+         for( uint32_t i = 0; i < bucket_count; ++i ) {
+            seen += snapshot[i];
+            if( seen >= rank ) return upper_bound_of( i );
+         }
+         return upper_bound_of( bucket_count - 1 );
+      }
+
+      std::array<std::atomic<uint64_t>, bucket_count>  counts;
+      std::atomic<uint64_t>                            total{0};
+      std::atomic<uint64_t>                            sum{0};
+      std::atomic<uint64_t>                            max{0};
+};
+
+} // namespace eosio
+
+FC_REFLECT( eosio::latency_histogram::summary, (count)(mean_us)(p50_us)(p90_us)(p99_us)(p999_us)(max_us) )
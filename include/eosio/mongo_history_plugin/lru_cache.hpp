@@ -0,0 +1,132 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <fc/time.hpp>
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace eosio {
+
+/**
+ *  Size bounded LRU cache split into independently locked shards so lookups from concurrent
+ *  requests rarely contend. Irreversible entries stay until they are evicted to make room.
+ *  Reversible entries also expire after their TTL, and as soon as the head block they were
+ *  cached at is no longer the head.
+ */
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class lru_cache {
+   public:
+      struct stats {
+         uint64_t hits = 0;
+         uint64_t misses = 0;
+         uint64_t evictions = 0;
+         uint64_t expirations = 0;
+         uint64_t entries = 0;
+         uint64_t bytes = 0;
+      };
+
+      explicit lru_cache( size_t max_bytes, size_t shard_count = 16 )
+      :max_shard_bytes( max_bytes / shard_count ) {
+         for( size_t i = 0; i < shard_count; ++i )
+            shards.emplace_back( std::make_unique<shard>() );
+      }
+
+      bool enabled()const { return max_shard_bytes > 0; }
+
+      std::shared_ptr<const Value> get( const Key& k, uint32_t head_block_num, const fc::time_point& now ) {
+         auto& s = shard_of( k );
+         std::lock_guard<std::mutex> g( s.mtx );
+         auto itr = s.index.find( k );
+         if( itr == s.index.end() ) {
+            ++misses;
+            return {};
+         }
+         auto e = itr->second;
+         if( e->reversible && (e->head_block_num != head_block_num || now >= e->expires) ) {
+            ++expirations;
+            ++misses;
+            erase( s, itr );
+            return {};
+         }
+         s.lru.splice( s.lru.begin(), s.lru, e );
+         ++hits;
+         return e->value;
+      }
+
+      /// reversible entries are valid while head_block_num is the head and until expires
+      void put( const Key& k, std::shared_ptr<const Value> v, size_t bytes, bool reversible,
+                uint32_t head_block_num, const fc::time_point& expires ) {
+         if( bytes > max_shard_bytes ) return;
+         auto& s = shard_of( k );
+         std::lock_guard<std::mutex> g( s.mtx );
+         auto itr = s.index.find( k );
+         if( itr != s.index.end() ) erase( s, itr );
+         while( s.bytes + bytes > max_shard_bytes && !s.lru.empty() ) {
+            ++evictions;
+            erase( s, s.index.find( s.lru.back().key ) );
+         }
+         s.lru.emplace_front( entry{ k, std::move( v ), bytes, reversible, head_block_num, expires } );
+         s.index.emplace( k, s.lru.begin() );
+         s.bytes += bytes;
+      }
+
+      stats get_stats()const {
+         stats r;
+         r.hits = hits;
+         r.misses = misses;
+         r.evictions = evictions;
+         r.expirations = expirations;
+         for( const auto& s : shards ) {
+            std::lock_guard<std::mutex> g( s->mtx );
+            r.entries += s->lru.size();
+            r.bytes += s->bytes;
+         }
+         return r;
+      }
+
+   private:
+      struct entry {
+         Key                           key;
+         std::shared_ptr<const Value>  value;
+         size_t                        bytes = 0;
+         bool                          reversible = false;
+         uint32_t                      head_block_num = 0;
+         fc::time_point                expires;
+      };
+      using entry_list = std::list<entry>;
+
+      struct shard {
+         mutable std::mutex                                               mtx;
+         entry_list                                                       lru;
+         std::unordered_map<Key, typename entry_list::iterator, Hash>     index;
+         size_t                                                           bytes = 0;
+      };
+
+      shard& shard_of( const Key& k ) {
+         return *shards[ Hash()( k ) % shards.size() ];
+      }
+
+      void erase( shard& s, typename decltype(shard::index)::iterator itr ) {
+         s.bytes -= itr->second->bytes;
+         s.lru.erase( itr->second );
+         s.index.erase( itr );
+      }
+
+      std::vector<std::unique_ptr<shard>>  shards;
+      const size_t                         max_shard_bytes;
+      std::atomic<uint64_t>                hits{0};
+      std::atomic<uint64_t>                misses{0};
+      std::atomic<uint64_t>                evictions{0};
+      std::atomic<uint64_t>                expirations{0};
+};
+
+} // namespace eosio
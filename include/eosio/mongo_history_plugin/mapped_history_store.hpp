@@ -0,0 +1,430 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/mongo_history_plugin/history_backend.hpp>
+
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/types.hpp>
+
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace eosio {
+
+/**
+ *  Embedded history store, a history_backend that needs no MongoDB. Transaction and trace documents
+ *  are appended as BSON to transactions.log and traces.log and read in place from read only
+ *  mappings of those files, trace scans visit documents without copying them. Three append only
+ *  files of fixed size records index the logs: trace_ids.idx and trx_ids.idx map transaction ids
+ *  to log offsets, accounts.idx maps the accounts a trace_scan matches to trace offsets. They are
+ *  loaded into memory at startup without touching the logs.
+ *
+ *  A batch of whole blocks is written log first and trace_ids.idx last, synced, then committed by
+ *  rewriting commit.dat with the size of every file and the last block written. Opening the store
+ *  cuts everything past the commit off, so a crash loses whole blocks after last_block(), which a
+ *  replay of the chain ingests again. Stores without commit.dat fall back to trace_ids.idx, whose
+ *  records mark traces as complete. Records are in native byte order. Keys and account controls are
+ *  not stored, the chainbase indices they are answered from persist in the state database.
+ */
+class mapped_history_store : public history_backend {
+   public:
+      explicit mapped_history_store( const boost::filesystem::path& dir ) {
+         boost::filesystem::create_directories( dir );
+         traces.open( dir / "traces.log" );
+         transactions.open( dir / "transactions.log" );
+         trace_ids.open( dir / "trace_ids.idx", sizeof( id_record ) );
+         trx_ids.open( dir / "trx_ids.idx", sizeof( id_record ) );
+         accounts.open( dir / "accounts.idx", sizeof( account_record ) );
+         commit_file.open( dir / "commit.dat", sizeof( commit_record ), 0 );
+         recover();
+      }
+
+      /**
+       *  Appends and commits the documents of the blocks up to block_num. Trace documents get their log
+       *  offset as _id, which orders them like ObjectIds order MongoDB documents. Only the writer thread
+       *  appends, a failed append leaves the store as it was after the last commit.
+       */
+      void append( const std::vector<bsoncxx::document::value>& trxs, const std::vector<bsoncxx::document::value>& trace_docs,
+                   uint32_t block_num ) {
+         using namespace bsoncxx::builder::basic;
+         std::string trx_data;
+         std::vector<id_record> new_trx_ids;
+         for( const auto& trx : trxs ) {
+            new_trx_ids.push_back( id_record{ to_id( trx.view()["trx_id"] ), transactions.size + trx_data.size() } );
+            trx_data.append( reinterpret_cast<const char*>( trx.view().data() ), trx.view().length() );
+         }
+
+         std::string trace_data;
+         std::vector<id_record> new_trace_ids;
+         std::vector<account_record> new_accounts;
+         for( const auto& trace : trace_docs ) {
+            const uint64_t offset = traces.size + trace_data.size();
+            document doc;
+            doc.append( kvp( "_id", bsoncxx::types::b_int64{ int64_t( offset ) } ) );
+            doc.append( bsoncxx::builder::concatenate_doc{ trace.view() } );
+            const auto v = doc.view();
+            trace_data.append( reinterpret_cast<const char*>( v.data() ), v.length() );
+            new_trace_ids.push_back( id_record{ to_id( trace.view()["id"] ), offset } );
+            const size_t first = new_accounts.size();
+            for_each_scanned_account( trace.view(), [&]( uint64_t account ) {
+               if( std::none_of( new_accounts.begin() + first, new_accounts.end(),
+                                 [&]( const account_record& r ) { return r.account == account; } ) )
+                  new_accounts.push_back( account_record{ account, offset } );
+            });
+         }
+
+         commit_record next = committed;
+         next.block_num = block_num;
+         next.transactions_size += trx_data.size();
+         next.traces_size += trace_data.size();
+         next.trx_ids += new_trx_ids.size();
+         next.trace_ids += new_trace_ids.size();
+         next.accounts += new_accounts.size();
+         try {
+            transactions.append( trx_data );
+            traces.append( trace_data );
+            trx_ids.append( new_trx_ids );
+            accounts.append( new_accounts );
+            trace_ids.append( new_trace_ids );
+            for( int fd : { transactions.fd, traces.fd, trx_ids.fd, accounts.fd, trace_ids.fd } ) sync( fd );
+
+            {
+               std::unique_lock<std::shared_timed_mutex> g( mtx );
+               transactions.remap();
+               traces.remap();
+            }
+            write_commit( next );
+         } catch( ... ) {
+            rollback();
+            throw;
+         }
+         committed = next;
+
+         std::unique_lock<std::shared_timed_mutex> g( mtx );
+         index( new_trx_ids, new_trace_ids, new_accounts );
+      }
+
+      /// last block whose history is committed, 0 if none is
+      uint32_t last_block()const {
+         return committed.block_num;
+      }
+
+      uint64_t trace_count()const {
+         std::shared_lock<std::shared_timed_mutex> g( mtx );
+         return trace_by_id.size();
+      }
+
+      /// max_time is not enforced, the caller checks its deadline between documents
+      void scan_traces( const trace_scan& scan, const document_visitor& visit )const override {
+         std::shared_lock<std::shared_timed_mutex> g( mtx );
+         std::vector<const std::vector<uint64_t>*> lists;
+         for( const auto& a : scan.accounts.empty() ? std::vector<chain::account_name>{ scan.account } : scan.accounts ) {
+            auto itr = traces_of.find( a.value );
+            if( itr != traces_of.end() ) lists.push_back( &itr->second );
+         }
+         fc::optional<uint64_t> from;
+         if( scan.from_id ) from = from_offset( *scan.from_id );
+         scan_positions( lists, scan.sort, from, scan.skip, [&]( uint64_t offset ) {
+            return visit( traces.document_at( offset ) );
+         } );
+      }
+
+      std::vector<bsoncxx::document::value> find_transaction_traces( const std::string& id, size_t limit )const override {
+         using namespace bsoncxx::builder::basic;
+         // every id with the prefix sorts at or after the prefix padded with zeros
+         const chain::transaction_id_type low( id + std::string( 64 - std::min<size_t>( id.size(), 64 ), '0' ) );
+         std::vector<bsoncxx::document::value> result;
+         std::shared_lock<std::shared_timed_mutex> g( mtx );
+         for( auto itr = trace_by_id.lower_bound( low ); itr != trace_by_id.end() && result.size() < limit; ++itr ) {
+            const auto hex = itr->first.str();
+            if( hex.compare( 0, id.size(), id ) != 0 ) break;
+            array trx;
+            auto t = trx_by_id.find( itr->first );
+            if( t != trx_by_id.end() ) trx.append( transactions.document_at( t->second ) );
+            document doc;
+            doc.append( bsoncxx::builder::concatenate_doc{ traces.document_at( itr->second ) } );
+            doc.append( bsoncxx::builder::basic::kvp( "trx", trx.extract() ) );
+            result.emplace_back( doc.extract() );
+         }
+         return result;
+      }
+
+      void for_each_trace_account( const std::function<void( uint64_t )>& f )const override {
+         std::shared_lock<std::shared_timed_mutex> g( mtx );
+         for( const auto& a : traces_of ) f( a.first );
+      }
+
+      /// the store keeps no account_actions
+      void for_each_action_account( const std::function<void( uint64_t )>& )const override {}
+
+      void for_each_pub_key( const document_visitor& )const override {}
+      void for_each_account_control( const document_visitor& )const override {}
+
+   private:
+      struct id_record {
+         chain::transaction_id_type  id;
+         uint64_t                    offset = 0;
+      };
+
+      struct account_record {
+         uint64_t  account = 0;
+         uint64_t  offset = 0;
+      };
+
+      /// sizes of the files and the last block at the last commit, one record written in place
+      struct commit_record {
+         uint64_t  traces_size = 0;
+         uint64_t  transactions_size = 0;
+         uint64_t  trace_ids = 0;
+         uint64_t  trx_ids = 0;
+         uint64_t  accounts = 0;
+         uint32_t  block_num = 0;
+         uint32_t  check = 0;   ///< checksum() of the fields above, a torn record is ignored
+
+         uint32_t checksum()const {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for( uint64_t v : { traces_size, transactions_size, trace_ids, trx_ids, accounts, uint64_t( block_num ) } ) {
+               h = (h ^ v) * 0x100000001b3ULL;
+            }
+            return uint32_t( h ^ (h >> 32) );
+         }
+      };
+
+      /// append only file of BSON documents, mapped read only beyond its end so appends rarely remap
+      struct log_file {
+         int       fd = -1;
+         uint64_t  size = 0;
+         char*     base = nullptr;
+         uint64_t  mapped = 0;
+
+         ~log_file() {
+            if( base ) ::munmap( base, mapped );
+            if( fd >= 0 ) ::close( fd );
+         }
+
+         void open( const boost::filesystem::path& p ) {
+            fd = ::open( p.string().c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+            EOS_ASSERT( fd >= 0, chain::plugin_exception, "Unable to open ${p}: ${e}", ("p", p.string())("e", strerror( errno )) );
+            struct stat st;
+            EOS_ASSERT( ::fstat( fd, &st ) == 0, chain::plugin_exception, "Unable to stat ${p}", ("p", p.string()) );
+            size = uint64_t( st.st_size );
+         }
+
+         void truncate( uint64_t n ) {
+            EOS_ASSERT( ::ftruncate( fd, off_t( n ) ) == 0, chain::plugin_exception, "Unable to truncate history store log" );
+            size = n;
+         }
+
+         void append( const std::string& data ) {
+            write_all( fd, data.data(), data.size() );
+            size += data.size();
+         }
+
+         /// pages past the end of the file are mapped but never read
+         void remap() {
+            if( size <= mapped && base ) return;
+            uint64_t capacity = std::max<uint64_t>( mapped, 64 * 1024 * 1024 );
+            while( capacity < size ) capacity *= 2;
+            if( base ) ::munmap( base, mapped );
+            void* p = ::mmap( nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0 );
+            EOS_ASSERT( p != MAP_FAILED, chain::plugin_exception, "Unable to map history store log: ${e}", ("e", strerror( errno )) );
+            base = static_cast<char*>( p );
+            mapped = capacity;
+         }
+
+         /// length of the document at offset, 0 if it is not completely in the file
+         uint32_t length_at( uint64_t offset )const {
+            if( offset + 4 > size ) return 0;
+            int32_t len;
+            std::memcpy( &len, base + offset, sizeof( len ) );
+            return len >= 5 && offset + uint64_t( len ) <= size ? uint32_t( len ) : 0;
+         }
+
+         bsoncxx::document::view document_at( uint64_t offset )const {
+            int32_t len;
+            std::memcpy( &len, base + offset, sizeof( len ) );
+            return bsoncxx::document::view( reinterpret_cast<const uint8_t*>( base + offset ), size_t( len ) );
+         }
+      };
+
+      /// append only file of fixed size records, or a record rewritten in place without O_APPEND
+      struct index_file {
+         int       fd = -1;
+         size_t    record_size = 0;
+
+         ~index_file() {
+            if( fd >= 0 ) ::close( fd );
+         }
+
+         void open( const boost::filesystem::path& p, size_t rs, int flags = O_APPEND ) {
+            record_size = rs;
+            fd = ::open( p.string().c_str(), O_RDWR | O_CREAT | flags, 0644 );
+            EOS_ASSERT( fd >= 0, chain::plugin_exception, "Unable to open ${p}: ${e}", ("p", p.string())("e", strerror( errno )) );
+         }
+
+         /// every complete record, a torn record at the end is cut off
+         template<typename Record>
+         std::vector<Record> load() {
+            struct stat st;
+            EOS_ASSERT( ::fstat( fd, &st ) == 0, chain::plugin_exception, "Unable to stat history store index" );
+            std::vector<Record> records( size_t( st.st_size ) / record_size );
+            size_t done = 0;
+            char* out = reinterpret_cast<char*>( records.data() );
+            while( done < records.size() * record_size ) {
+               auto n = ::pread( fd, out + done, records.size() * record_size - done, off_t( done ) );
+               EOS_ASSERT( n > 0, chain::plugin_exception, "Unable to read history store index: ${e}", ("e", strerror( errno )) );
+               done += size_t( n );
+            }
+            truncate( records.size() );
+            return records;
+         }
+
+         void truncate( size_t records ) {
+            EOS_ASSERT( ::ftruncate( fd, off_t( records * record_size ) ) == 0, chain::plugin_exception,
+                        "Unable to truncate history store index" );
+         }
+
+         template<typename Record>
+         void append( const std::vector<Record>& records ) {
+            write_all( fd, reinterpret_cast<const char*>( records.data() ), records.size() * sizeof( Record ) );
+         }
+      };
+
+      static void sync( int fd ) {
+         EOS_ASSERT( ::fdatasync( fd ) == 0, chain::plugin_exception, "Unable to sync history store: ${e}", ("e", strerror( errno )) );
+      }
+
+      void write_commit( commit_record r ) {
+         r.check = r.checksum();
+         const char* data = reinterpret_cast<const char*>( &r );
+         for( size_t done = 0; done < sizeof( r ); ) {
+            auto n = ::pwrite( commit_file.fd, data + done, sizeof( r ) - done, off_t( done ) );
+            if( n < 0 && errno == EINTR ) continue;
+            EOS_ASSERT( n > 0, chain::plugin_exception, "Unable to commit history store: ${e}", ("e", strerror( errno )) );
+            done += size_t( n );
+         }
+         sync( commit_file.fd );
+      }
+
+      /// cuts every file back to the last commit
+      void rollback() {
+         traces.truncate( committed.traces_size );
+         transactions.truncate( committed.transactions_size );
+         trace_ids.truncate( size_t( committed.trace_ids ) );
+         trx_ids.truncate( size_t( committed.trx_ids ) );
+         accounts.truncate( size_t( committed.accounts ) );
+      }
+
+      static void write_all( int fd, const char* data, size_t n ) {
+         while( n > 0 ) {
+            auto written = ::write( fd, data, n );
+            if( written < 0 && errno == EINTR ) continue;
+            EOS_ASSERT( written > 0, chain::plugin_exception, "Unable to write history store: ${e}", ("e", strerror( errno )) );
+            data += written;
+            n -= size_t( written );
+         }
+      }
+
+      static chain::transaction_id_type to_id( const bsoncxx::document::element& ele ) {
+         return chain::transaction_id_type( ele.get_utf8().value.to_string() );
+      }
+
+      static uint64_t from_offset( const bsoncxx::document::value& from ) {
+         return uint64_t( from.view()["id"].get_int64().value );
+      }
+
+      /// drops whatever a crash left behind the last commit, or the last complete trace and transaction, then loads the indices
+      void recover() {
+         auto commits = commit_file.load<commit_record>();
+         if( !commits.empty() && commits.front().check == commits.front().checksum() ) {
+            committed = commits.front();
+            rollback();
+         }
+
+         auto trace_records = trace_ids.load<id_record>();
+         size_t valid = 0;
+         uint64_t trace_end = 0;
+         traces.remap();
+         for( ; valid < trace_records.size(); ++valid ) {
+            const auto len = traces.length_at( trace_records[valid].offset );
+            if( len == 0 ) break;
+            trace_end = trace_records[valid].offset + len;
+         }
+         trace_records.resize( valid );
+         trace_ids.truncate( valid );
+         traces.truncate( trace_end );
+
+         auto trx_records = trx_ids.load<id_record>();
+         valid = 0;
+         uint64_t trx_end = 0;
+         transactions.remap();
+         for( ; valid < trx_records.size(); ++valid ) {
+            const auto len = transactions.length_at( trx_records[valid].offset );
+            if( len == 0 ) break;
+            trx_end = trx_records[valid].offset + len;
+         }
+         trx_records.resize( valid );
+         trx_ids.truncate( valid );
+         transactions.truncate( trx_end );
+
+         auto account_records = accounts.load<account_record>();
+         valid = 0;
+         while( valid < account_records.size() && account_records[valid].offset < trace_end ) ++valid;
+         account_records.resize( valid );
+         accounts.truncate( valid );
+
+         const uint32_t block_num = committed.block_num;
+         committed = commit_record{ trace_end, trx_end, trace_records.size(), trx_records.size(), account_records.size(), block_num };
+         write_commit( committed );
+         index( trx_records, trace_records, account_records );
+      }
+
+      void index( const std::vector<id_record>& trx_records, const std::vector<id_record>& trace_records,
+                  const std::vector<account_record>& account_records ) {
+         for( const auto& r : trx_records ) {
+            trx_by_id[r.id] = r.offset;
+         }
+         // a transaction traced twice keeps its first trace, as the MongoDB lookup returns it first
+         for( const auto& r : trace_records ) {
+            trace_by_id.emplace( r.id, r.offset );
+         }
+         for( const auto& r : account_records ) {
+            traces_of[r.account].push_back( r.offset );
+         }
+      }
+
+      log_file                                              traces;
+      log_file                                              transactions;
+      index_file                                            trace_ids;
+      index_file                                            trx_ids;
+      index_file                                            accounts;
+      index_file                                            commit_file;
+      commit_record                                         committed;   ///< writer thread only
+
+      // readers hold mtx shared while they use views into the mappings, the writer remaps exclusively
+      mutable std::shared_timed_mutex                       mtx;
+      std::map<chain::transaction_id_type, uint64_t>        trace_by_id;
+      std::map<chain::transaction_id_type, uint64_t>        trx_by_id;
+      std::unordered_map<uint64_t, std::vector<uint64_t>>   traces_of;   ///< account value to ascending trace offsets
+};
+
+} // namespace eosio
@@ -0,0 +1,111 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/mongo_history_plugin/history_backend.hpp>
+
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+namespace eosio {
+
+/**
+ *  history_backend over documents held in memory, for measuring the read path without a mongod.
+ *  Traces get ascending int64 _ids in the order they are added and are indexed by the accounts the
+ *  MongoDB query of a trace_scan matches, so scans visit the same documents in the same order.
+ *  Documents are added before the API is served, the backend is read only afterwards.
+ */
+class memory_history_backend : public history_backend {
+   public:
+      void add_trace( const bsoncxx::document::view& trace ) {
+         using namespace bsoncxx::builder::basic;
+         const int64_t id = int64_t( traces.size() );
+         document doc;
+         doc.append( kvp( "_id", bsoncxx::types::b_int64{ id } ) );
+         doc.append( bsoncxx::builder::concatenate_doc{ trace } );
+         traces.emplace_back( doc.extract() );
+         trace_by_id.emplace( trace["id"].get_utf8().value.to_string(), size_t( id ) );
+
+         for_each_scanned_account( trace, [&]( uint64_t account ) {
+            auto& ids = traces_of[account];
+            if( ids.empty() || ids.back() != id ) ids.push_back( id );
+         });
+      }
+
+      void add_transaction( const bsoncxx::document::view& trx ) {
+         trx_by_id.emplace( trx["trx_id"].get_utf8().value.to_string(), transactions.size() );
+         transactions.emplace_back( trx );
+      }
+
+      void add_pub_key( const bsoncxx::document::view& key ) { pub_keys.emplace_back( key ); }
+      void add_account_control( const bsoncxx::document::view& control ) { account_controls.emplace_back( control ); }
+
+      size_t trace_count()const { return traces.size(); }
+
+      /// max_time is not enforced, the caller checks its deadline between documents
+      void scan_traces( const trace_scan& scan, const document_visitor& visit )const override {
+         std::vector<const std::vector<int64_t>*> lists;
+         for( const auto& a : scan.accounts.empty() ? std::vector<chain::account_name>{ scan.account } : scan.accounts ) {
+            auto itr = traces_of.find( a.value );
+            if( itr != traces_of.end() ) lists.push_back( &itr->second );
+         }
+         fc::optional<int64_t> from;
+         if( scan.from_id ) from = scan.from_id->view()["id"].get_int64().value;
+         scan_positions( lists, scan.sort, from, scan.skip, [&]( int64_t id ) {
+            return visit( traces[size_t( id )].view() );
+         } );
+      }
+
+      std::vector<bsoncxx::document::value> find_transaction_traces( const std::string& id, size_t limit )const override {
+         using namespace bsoncxx::builder::basic;
+         std::vector<bsoncxx::document::value> result;
+         for( auto itr = trace_by_id.lower_bound( id );
+              itr != trace_by_id.end() && itr->first.compare( 0, id.size(), id ) == 0 && result.size() < limit; ++itr ) {
+            array trx;
+            auto t = trx_by_id.find( itr->first );
+            if( t != trx_by_id.end() ) trx.append( transactions[t->second].view() );
+            document doc;
+            doc.append( bsoncxx::builder::concatenate_doc{ traces[itr->second].view() } );
+            doc.append( kvp( "trx", trx.extract() ) );
+            result.emplace_back( doc.extract() );
+         }
+         return result;
+      }
+
+      void for_each_trace_account( const std::function<void( uint64_t )>& f )const override {
+         for( const auto& a : traces_of ) f( a.first );
+      }
+
+      /// synthetic history has no account_actions
+      void for_each_action_account( const std::function<void( uint64_t )>& )const override {}
+
+      void for_each_pub_key( const document_visitor& visit )const override {
+         for( const auto& k : pub_keys ) {
+            if( !visit( k.view() ) ) return;
+         }
+      }
+
+      void for_each_account_control( const document_visitor& visit )const override {
+         for( const auto& c : account_controls ) {
+            if( !visit( c.view() ) ) return;
+         }
+      }
+
+   private:
+      std::vector<bsoncxx::document::value>             traces;       ///< indexed by _id
+      std::map<std::string, size_t>                     trace_by_id;  ///< ordered for id prefix lookups
+      std::unordered_map<uint64_t, std::vector<int64_t>> traces_of;   ///< account value to ascending _ids
+      std::vector<bsoncxx::document::value>             transactions;
+      std::unordered_map<std::string, size_t>           trx_by_id;
+      std::vector<bsoncxx::document::value>             pub_keys;
+      std::vector<bsoncxx::document::value>             account_controls;
+};
+
+} // namespace eosio
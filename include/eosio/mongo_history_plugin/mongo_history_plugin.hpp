@@ -6,6 +6,7 @@
 #include <appbase/application.hpp>
 
 #include <eosio/chain_plugin/chain_plugin.hpp>
+#include <eosio/mongo_history_plugin/latency_histogram.hpp>
 
 namespace fc { class variant; }
 
@@ -33,6 +34,8 @@ namespace eosio {
             chain::account_name account_name;
             optional<int32_t>   pos; /// a absolute sequence positon -1 is the end/last action
             optional<int32_t>   offset; ///< the number of actions relative to pos, negative numbers return [pos-offset,pos), positive numbers return [pos,pos+offset)
+            optional<string>    cursor; ///< next_cursor of a previous page, pos is ignored and abs(offset) is the page size
+            optional<uint32_t>  time_limit_ms; ///< lowers history-mongodb-query-time-ms for this request
             };
 
             struct ordered_action_result {
@@ -47,10 +50,37 @@ namespace eosio {
             vector<ordered_action_result> actions;
             uint32_t                      last_irreversible_block;
             optional<bool>                time_limit_exceeded_error;
+            optional<string>              next_cursor; ///< continues after the last returned action
             };
 
             get_actions_result get_actions( const get_actions_params& )const;
 
+            struct account_actions_page {
+            chain::account_name account_name;
+            optional<int32_t>   pos;    ///< as in get_actions_params
+            optional<int32_t>   offset;
+            };
+
+            struct get_accounts_actions_params {
+            vector<account_actions_page>  accounts;
+            optional<uint32_t>            time_limit_ms; ///< shared by all accounts
+            };
+
+            struct account_actions_result {
+            chain::account_name           account_name;
+            vector<ordered_action_result> actions;
+            optional<bool>                time_limit_exceeded_error;
+            optional<string>              next_cursor; ///< continues this account with get_actions
+            };
+
+            struct get_accounts_actions_result {
+            vector<account_actions_result> accounts; ///< in the order of the requested accounts
+            uint32_t                       last_irreversible_block = 0;
+            };
+
+            /// pages of many accounts in a few round trips, each page is the one get_actions returns
+            get_accounts_actions_result get_accounts_actions( const get_accounts_actions_params& )const;
+
             struct get_transaction_params {
             string                        id;
             optional<uint32_t>            block_num_hint;
@@ -93,6 +123,56 @@ namespace eosio {
             vector<chain::account_name> controlled_accounts;
             };
             get_controlled_accounts_results get_controlled_accounts(const get_controlled_accounts_params& params) const;
+
+            struct get_stats_params {};
+
+            /// latencies in microseconds since startup, stages only of requests that reached MongoDB
+            struct endpoint_stats {
+            string                         endpoint;
+            latency_histogram::summary     total;
+            latency_histogram::summary     mongo_fetch; ///< waiting for MongoDB, connection checkout excluded
+            latency_histogram::summary     decode;      ///< BSON to variant conversion
+            latency_histogram::summary     filter;      ///< picking the account's traces out of transactions
+            uint64_t                       docs_scanned = 0;
+            uint64_t                       docs_returned = 0;
+            uint64_t                       bytes_received = 0;
+            optional<uint64_t>             coalesced;   ///< requests that shared an identical request in flight
+            };
+
+            struct cache_stats {
+            string                         cache;
+            uint64_t                       entries = 0;
+            uint64_t                       bytes = 0;
+            uint64_t                       hits = 0;
+            uint64_t                       misses = 0;
+            uint64_t                       evictions = 0;
+            uint64_t                       expirations = 0;
+            };
+
+            struct pool_stats {
+            uint32_t                       max_size = 0;
+            uint32_t                       in_use = 0;
+            uint32_t                       peak = 0;
+            uint64_t                       waits = 0;
+            uint64_t                       timeouts = 0;
+            };
+
+            struct filter_stats {
+            bool                           loaded = false;
+            uint64_t                       bits = 0;
+            uint32_t                       hashes = 0;
+            uint64_t                       estimated_accounts = 0;
+            uint64_t                       rejected = 0;   ///< requests answered without a query
+            };
+
+            struct get_stats_result {
+            vector<endpoint_stats>         endpoints;
+            vector<cache_stats>            caches;
+            pool_stats                     pool;
+            optional<filter_stats>         account_filter;
+            };
+
+            get_stats_result get_stats( const get_stats_params& )const;
       };
 
 } // namespace mongo_history_apis
@@ -128,9 +208,13 @@ class mongo_history_plugin : public plugin<mongo_history_plugin> {
 
 } /// namespace eosio
 
-FC_REFLECT( eosio::mongo_history_apis::read_only::get_actions_params, (account_name)(pos)(offset) )
-FC_REFLECT( eosio::mongo_history_apis::read_only::get_actions_result, (actions)(last_irreversible_block)(time_limit_exceeded_error) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::get_actions_params, (account_name)(pos)(offset)(cursor)(time_limit_ms) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::get_actions_result, (actions)(last_irreversible_block)(time_limit_exceeded_error)(next_cursor) )
 FC_REFLECT( eosio::mongo_history_apis::read_only::ordered_action_result, (global_action_seq)(account_action_seq)(block_num)(block_time)(action_trace) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::account_actions_page, (account_name)(pos)(offset) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::get_accounts_actions_params, (accounts)(time_limit_ms) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::account_actions_result, (account_name)(actions)(time_limit_exceeded_error)(next_cursor) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::get_accounts_actions_result, (accounts)(last_irreversible_block) )
 
 FC_REFLECT( eosio::mongo_history_apis::read_only::get_transaction_params, (id)(block_num_hint) )
 FC_REFLECT( eosio::mongo_history_apis::read_only::get_transaction_result, (id)(trx)(block_time)(block_num)(last_irreversible_block)(traces) )
@@ -139,3 +223,10 @@ FC_REFLECT(eosio::mongo_history_apis::read_only::get_key_accounts_params, (publi
 FC_REFLECT(eosio::mongo_history_apis::read_only::get_key_accounts_results, (account_names) )
 FC_REFLECT(eosio::mongo_history_apis::read_only::get_controlled_accounts_params, (controlling_account) )
 FC_REFLECT(eosio::mongo_history_apis::read_only::get_controlled_accounts_results, (controlled_accounts) )
+
+FC_REFLECT( eosio::mongo_history_apis::read_only::get_stats_params, )
+FC_REFLECT( eosio::mongo_history_apis::read_only::endpoint_stats, (endpoint)(total)(mongo_fetch)(decode)(filter)(docs_scanned)(docs_returned)(bytes_received)(coalesced) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::cache_stats, (cache)(entries)(bytes)(hits)(misses)(evictions)(expirations) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::pool_stats, (max_size)(in_use)(peak)(waits)(timeouts) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::filter_stats, (loaded)(bits)(hashes)(estimated_accounts)(rejected) )
+FC_REFLECT( eosio::mongo_history_apis::read_only::get_stats_result, (endpoints)(caches)(pool)(account_filter) )
@@ -0,0 +1,84 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace eosio {
+
+/**
+ *  Collapses concurrent calls with the same key into one: the first caller runs the query, callers
+ *  arriving while it is in flight wait for it and share its result, or its exception. Nothing is
+ *  kept once the call completes, caching finished results is left to lru_cache.
+ */
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class single_flight {
+   public:
+      struct stats {
+         uint64_t executed = 0;   ///< calls that ran the query
+         uint64_t coalesced = 0;  ///< calls that shared the result of a call in flight
+         uint64_t in_flight = 0;
+      };
+
+      template<typename F>
+      std::shared_ptr<const Value> run( const Key& k, F&& f ) {
+         std::promise<std::shared_ptr<const Value>> leader;
+         std::shared_future<std::shared_ptr<const Value>> result;
+         bool is_leader = false;
+         {
+            std::lock_guard<std::mutex> g( mtx );
+            auto itr = calls.find( k );
+            if( itr != calls.end() ) {
+               ++coalesced;
+               result = itr->second;
+            } else {
+               ++executed;
+               is_leader = true;
+               result = leader.get_future().share();
+               calls.emplace( k, result );
+            }
+         }
+         if( !is_leader ) return result.get();
+
+         std::shared_ptr<const Value> v;
+         std::exception_ptr error;
+         try {
+            v = std::make_shared<const Value>( f() );
+         } catch( ... ) {
+            error = std::current_exception();
+         }
+         {
+            // later callers run their own query
+            std::lock_guard<std::mutex> g( mtx );
+            calls.erase( k );
+         }
+         if( error ) leader.set_exception( error );
+         else leader.set_value( v );
+         return result.get();
+      }
+
+      stats get_stats()const {
+         stats r;
+         r.executed = executed;
+         r.coalesced = coalesced;
+         std::lock_guard<std::mutex> g( mtx );
+         r.in_flight = calls.size();
+         return r;
+      }
+
+   private:
+      mutable std::mutex                                                               mtx;
+      std::unordered_map<Key, std::shared_future<std::shared_ptr<const Value>>, Hash>  calls;
+      std::atomic<uint64_t>                                                            executed{0};
+      std::atomic<uint64_t>                                                            coalesced{0};
+};
+
+} // namespace eosio
@@ -0,0 +1,158 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/trace.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/crypto/private_key.hpp>
+#include <fc/crypto/sha256.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace eosio {
+
+struct synthetic_history_config {
+   uint32_t  transactions = 100000;
+   uint32_t  accounts = 10000;
+   double    skew = 1.0;                 ///< zipf exponent of the accounts involved in actions, 0 is uniform
+   uint32_t  actions_per_transaction = 1;
+   uint32_t  transactions_per_block = 20;
+   uint64_t  seed = 1;
+};
+
+/**
+ *  Reproducible chain history for measuring the read path: token transfers between synthetic accounts
+ *  drawn from a zipf distribution, so a few accounts hold most of the history as on a real chain.
+ *  Every transfer is received by eosio.token and notifies both parties as inline traces, every account
+ *  has one key on owner and active, and every tenth account's active authority is also controlled by
+ *  another account. The same config always yields the same history.
+ */
+class synthetic_history {
+   public:
+      explicit synthetic_history( const synthetic_history_config& config )
+      :cfg( config ) {
+         cdf.reserve( cfg.accounts );
+         double total = 0;
+         for( uint32_t i = 0; i < cfg.accounts; ++i ) {
+            total += 1.0 / std::pow( double( i + 1 ), cfg.skew );
+            cdf.push_back( total );
+         }
+      }
+
+      /// "syn" followed by i in seven name digits
+      static chain::account_name account( uint32_t i ) {
+         static const char digits[] = "12345abcdefghijklmnopqrstuvwxyz";
+         std::string s( "syn.......", 10 );
+         for( int d = 9; d >= 3; --d ) {
+            s[d] = digits[i % 31];
+            i /= 31;
+         }
+         return chain::account_name( s );
+      }
+
+      /// calls f( trx, trace ) for every transaction in block order
+      template<typename F>
+      void for_each_transaction( F&& f ) {
+         static const chain::account_name token = N(eosio.token);
+         std::mt19937_64 rng( cfg.seed );
+         std::map<chain::account_name, uint64_t> recv_sequence;
+         std::map<chain::account_name, uint64_t> auth_sequence;
+         uint64_t global_sequence = 0;
+
+         auto receipt_for = [&]( const chain::account_name& receiver, const chain::account_name& actor ) {
+            chain::action_receipt r;
+            r.receiver = receiver;
+            r.global_sequence = ++global_sequence;
+            r.recv_sequence = ++recv_sequence[receiver];
+            r.auth_sequence[actor] = ++auth_sequence[actor];
+            r.code_sequence = 1;
+            r.abi_sequence = 1;
+            return r;
+         };
+
+         for( uint32_t i = 0; i < cfg.transactions; ++i ) {
+            const uint32_t block_num = 2 + i / std::max<uint32_t>( 1, cfg.transactions_per_block );
+
+            chain::signed_transaction trx;
+            trx.expiration = fc::time_point_sec( chain::block_timestamp_type( block_num ).to_time_point() ) + 30;
+            trx.ref_block_num = uint16_t( block_num );
+            trx.ref_block_prefix = i;   // unique ids
+            std::vector<std::pair<chain::account_name, chain::account_name>> transfers;
+            for( uint32_t a = 0; a < cfg.actions_per_transaction; ++a ) {
+               const auto from = account( sample( rng ) );
+               const auto to = account( sample( rng ) );
+               transfers.emplace_back( from, to );
+               trx.actions.emplace_back( chain::action( { chain::permission_level{ from, N(active) } }, token, N(transfer),
+                                                        chain::bytes( 32, char( a ) ) ) );
+            }
+
+            chain::transaction_trace trace;
+            trace.id = trx.id();
+            trace.block_num = block_num;
+            trace.block_time = chain::block_timestamp_type( block_num );
+            trace.receipt = chain::transaction_receipt_header( chain::transaction_receipt_header::executed );
+            trace.receipt->cpu_usage_us = 200;
+            trace.receipt->net_usage_words = 16;
+            trace.elapsed = fc::microseconds( 150 );
+            trace.net_usage = 128;
+            for( size_t a = 0; a < trx.actions.size(); ++a ) {
+               const auto& from = transfers[a].first;
+               chain::action_trace at( receipt_for( token, from ) );
+               at.act = trx.actions[a];
+               at.trx_id = trace.id;
+               at.block_num = block_num;
+               at.block_time = trace.block_time;
+               for( const auto& notified : { from, transfers[a].second } ) {
+                  chain::action_trace note( receipt_for( notified, from ) );
+                  note.act = trx.actions[a];
+                  note.trx_id = trace.id;
+                  note.block_num = block_num;
+                  note.block_time = trace.block_time;
+                  at.inline_traces.emplace_back( std::move( note ) );
+               }
+               trace.action_traces.emplace_back( std::move( at ) );
+            }
+            f( trx, trace );
+         }
+      }
+
+      /// calls f( account, permission, public_key ) for the keys of every account
+      template<typename F>
+      void for_each_key( F&& f )const {
+         for( uint32_t i = 0; i < cfg.accounts; ++i ) {
+            const auto n = account( i );
+            const auto key = fc::crypto::private_key::regenerate<fc::ecc::private_key_shim>(
+                  fc::sha256::hash( std::to_string( cfg.seed ) + n.to_string() ) ).get_public_key();
+            f( n, chain::permission_name( N(owner) ), chain::public_key_type( key ) );
+            f( n, chain::permission_name( N(active) ), chain::public_key_type( key ) );
+         }
+      }
+
+      /// calls f( controlled_account, controlled_permission, controlling_account ) for every account control
+      template<typename F>
+      void for_each_control( F&& f )const {
+         std::mt19937_64 rng( cfg.seed + 1 );
+         for( uint32_t i = 0; i < cfg.accounts; i += 10 ) {
+            f( account( i ), chain::permission_name( N(active) ), account( sample( rng ) ) );
+         }
+      }
+
+   private:
+      uint32_t sample( std::mt19937_64& rng )const {
+         std::uniform_real_distribution<double> u( 0, cdf.back() );
+         return uint32_t( std::upper_bound( cdf.begin(), cdf.end(), u( rng ) ) - cdf.begin() ) % cfg.accounts;
+      }
+
+      synthetic_history_config  cfg;
+      std::vector<double>       cdf;   ///< cumulative zipf weights by account index
+};
+
+} // namespace eosio
@@ -1,35 +1,74 @@
 #include <eosio/mongo_history_plugin/mongo_history_plugin.hpp>
 #include <eosio/mongo_history_plugin/account_control_history_object.hpp>
+#include <eosio/mongo_history_plugin/action_trace_filter.hpp>
+#include <eosio/mongo_history_plugin/bloom_filter.hpp>
+#include <eosio/mongo_history_plugin/bson.hpp>
+#include <eosio/mongo_history_plugin/compact_schema.hpp>
+#include <eosio/mongo_history_plugin/history_backend.hpp>
+#include <eosio/mongo_history_plugin/history_documents.hpp>
+#include <eosio/mongo_history_plugin/latency_histogram.hpp>
+#include <eosio/mongo_history_plugin/lru_cache.hpp>
+#include <eosio/mongo_history_plugin/mapped_history_store.hpp>
+#include <eosio/mongo_history_plugin/memory_history_backend.hpp>
 #include <eosio/mongo_history_plugin/public_key_history_object.hpp>
+#include <eosio/mongo_history_plugin/single_flight.hpp>
+#include <eosio/mongo_history_plugin/synthetic_history.hpp>
+#include <eosio/chain/contract_types.hpp>
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/trace.hpp>
 #include <eosio/chain_plugin/chain_plugin.hpp>
 
+#include <fc/bitutil.hpp>
 #include <fc/io/json.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/io/raw_variant.hpp>
 
+#include <mongocxx/bulk_write.hpp>
 #include <mongocxx/client.hpp>
 #include <mongocxx/collection.hpp>
 #include <mongocxx/instance.hpp>
+#include <mongocxx/pipeline.hpp>
 #include <mongocxx/pool.hpp>
+#include <mongocxx/exception/bulk_write_exception.hpp>
 #include <mongocxx/exception/operation_exception.hpp>
+#include <mongocxx/exception/query_exception.hpp>
 #include <mongocxx/exception/logic_error.hpp>
 
+#include <bsoncxx/builder/basic/array.hpp>
 #include <bsoncxx/builder/basic/kvp.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
 #include <bsoncxx/builder/stream/array.hpp>
 #include <bsoncxx/builder/stream/document.hpp>
 #include <bsoncxx/builder/stream/helpers.hpp>
 #include <bsoncxx/types.hpp>
 #include <bsoncxx/exception/exception.hpp>
 #include <bsoncxx/json.hpp>
+#include <bsoncxx/validate.hpp>
 #include <bsoncxx/stdx/string_view.hpp>
 #include <bsoncxx/document/value.hpp>
 #include <bsoncxx/document/view.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include <boost/algorithm/string.hpp>
-//#include <boost/signals2/connection.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/signals2/connection.hpp>
 
 
 namespace eosio {
@@ -44,26 +83,1378 @@ namespace eosio {
   using builder::concatenate;
   using types::b_regex;
   using types::b_document;
+  using boost::signals2::scoped_connection;
+
+  enum class actions_query_mode {
+      filter,    ///< fetch whole transaction_traces documents and filter the traces in the plugin
+      aggregate  ///< unwind and match the traces in an aggregation pipeline on the server
+  };
+
+  enum class index_check_mode {
+      off,      ///< no query plan checks
+      warn,     ///< log query shapes answered by a collection scan
+      require   ///< shut the node down if a query shape is answered by a collection scan
+  };
+
+  /// time spent and data read by one request, summed over the workers of a partitioned scan
+  struct request_metrics {
+      std::atomic<int64_t>   fetch_us{0};       ///< waiting for MongoDB
+      std::atomic<int64_t>   decode_us{0};      ///< BSON to variant conversion
+      std::atomic<int64_t>   filter_us{0};      ///< matching traces against accounts
+      std::atomic<uint64_t>  docs_scanned{0};
+      std::atomic<uint64_t>  bytes_received{0};
+  };
+
+  /// latency and volume of one read_only method since startup
+  struct endpoint_metrics {
+      latency_histogram      total;
+      latency_histogram      fetch;
+      latency_histogram      decode;
+      latency_histogram      filter;
+      std::atomic<uint64_t>  docs_scanned{0};
+      std::atomic<uint64_t>  docs_returned{0};
+      std::atomic<uint64_t>  bytes_received{0};
+
+      void record( const fc::time_point& start, const request_metrics& m, uint64_t returned ) {
+        total.record( (fc::time_point::now() - start).count() );
+        docs_returned += returned;
+        // requests answered from memory have no stages
+        if( m.fetch_us == 0 && m.docs_scanned == 0 ) return;
+        fetch.record( m.fetch_us );
+        decode.record( m.decode_us );
+        filter.record( m.filter_us );
+        docs_scanned += m.docs_scanned;
+        bytes_received += m.bytes_received;
+      }
+  };
+
+  /// chain data handed from the main thread to the writer thread
+  struct ingest_entry {
+      chain::transaction_trace_ptr    trace;            ///< applied transaction of an accepted block
+      chain::transaction_metadata_ptr trx;              ///< transaction of an accepted block
+      uint32_t                        forked_from = 0;  ///< when set, history from this block on was forked out
+      uint32_t                        block_num = 0;    ///< of trx, alone it follows the last entry of that block
+      uint32_t                        irreversible = 0; ///< when set, blocks up to this one can no longer fork out
+
+      bool ends_block()const { return !trace && !trx && block_num; }
+  };
+
+  /// written history of a reversible block the writer may still have to take back
+  struct unconfirmed_block {
+      std::vector<transaction_id_type>           trx_ids;
+      std::vector<chain::transaction_trace_ptr>  traces;   ///< key and control changes are written once irreversible
+  };
+
+  /// history of an accepted block: the last trace of every transaction in it, speculative runs are dropped.
+  /// In irreversible only mode it is held back until the block becomes irreversible.
+  struct staged_block {
+      block_id_type                              id;
+      uint32_t                                   block_num = 0;
+      signed_block_ptr                           block;
+      std::vector<chain::transaction_trace_ptr>  traces;
+      std::vector<chain::transaction_metadata_ptr> trxs;    ///< with ingest, input and deferred transactions of the block
+  };
 
   class mongo_history_plugin_impl {
       public:          
         chain_plugin*          chain_plug = nullptr;
-        //fc::optional<scoped_connection> applied_transaction_connection;
+        fc::optional<scoped_connection> applied_transaction_connection;
+        fc::optional<scoped_connection> accepted_transaction_connection;
+        fc::optional<scoped_connection> accepted_block_connection;
+        fc::optional<scoped_connection> irreversible_block_connection;
+
+        // documents the read_only API is answered from, MongoDB unless history-backend says otherwise
+        std::unique_ptr<history_backend> backend;
+        mapped_history_store* store = nullptr;   ///< backend, when history-backend = store
+        bool synthetic = false;   ///< history-backend = memory, its keys and controls stay out of the state database
 
         std::string db_name;
-        //mongocxx::instance mongo_inst;
-        mongocxx::client mongo_client;
+        std::unique_ptr<mongocxx::pool> mongo_pool;
+        uint32_t pool_max_size = 100;
+        fc::microseconds wait_queue_timeout = fc::milliseconds(1000);
+
+        // pool usage, updated concurrently from the http threads
+        mutable std::atomic<uint32_t> clients_in_use{0};
+        mutable std::atomic<uint32_t> clients_peak{0};
+        mutable std::atomic<uint64_t> acquire_waits{0};
+        mutable std::atomic<uint64_t> acquire_timeouts{0};
+        mutable std::atomic<int64_t>  last_saturation_log{0};
+
+        actions_query_mode actions_query = actions_query_mode::filter;
+
+        // partitioned transaction_traces scans, see get_partitioned_actions
+        uint32_t query_parallelism = 1;
+        std::unique_ptr<boost::asio::thread_pool> query_pool;
+
+        /// upper bound of a get_actions request, requests may ask for less with time_limit_ms
+        fc::microseconds query_time = fc::milliseconds(100);
+
+        // read_only instrumentation, every trace_sample_rate-th request logs its stages
+        mutable endpoint_metrics get_actions_metrics;
+        mutable endpoint_metrics get_accounts_actions_metrics;
+        mutable endpoint_metrics get_transaction_metrics;
+        mutable endpoint_metrics get_key_accounts_metrics;
+        mutable endpoint_metrics get_controlled_accounts_metrics;
+        uint32_t trace_sample_rate = 0;
+        mutable std::atomic<uint64_t> trace_sequence{0};
+
+        bool sample_trace()const {
+          return trace_sample_rate && trace_sequence.fetch_add( 1, std::memory_order_relaxed ) % trace_sample_rate == 0;
+        }
+
+        // converted results shared by the http threads, null when caching is disabled
+        using transaction_cache = lru_cache<std::string, mongo_history_apis::read_only::get_transaction_result>;
+        using actions_cache_type = lru_cache<std::string, mongo_history_apis::read_only::get_actions_result>;
+        std::unique_ptr<transaction_cache>  trx_cache;
+        std::unique_ptr<actions_cache_type> actions_cache;
+        fc::microseconds                    reversible_cache_ttl = fc::milliseconds(500);
+        std::atomic<uint32_t>               head_block_num{0};
+        std::atomic<uint32_t>               lib_block_num{0};
+
+        // accounts with history: filled from the backend at startup and from every applied transaction,
+        // get_actions of an account it does not contain is answered without a query once it is loaded
+        std::unique_ptr<bloom_filter> account_filter;
+        std::atomic<bool>             account_filter_loaded{false};
+        mutable std::atomic<uint64_t> account_filter_rejected{0};
+
+        void load_account_filter();
+        void add_trace_accounts( const chain::action_trace& at );
+
+        /// false only if account certainly has no history
+        bool may_have_history( const account_name& account )const {
+          if( !account_filter_loaded.load( std::memory_order_acquire ) || account_filter->contains( account.value ) ) return true;
+          account_filter_rejected.fetch_add( 1, std::memory_order_relaxed );
+          return false;
+        }
+
+        // concurrent identical requests, keyed by their normalized parameters
+        mutable single_flight<std::string, mongo_history_apis::read_only::get_transaction_result> trx_flights;
+        mutable single_flight<std::string, mongo_history_apis::read_only::get_actions_result>     actions_flights;
+
+        void on_accepted_block( const chain::block_state_ptr& bs );
+        void log_cache_stats()const;
+
+        // indices are created and query plans checked on index_thread, see provision_indices
+        bool create_indices = true;
+        index_check_mode index_check = index_check_mode::warn;
+        std::thread index_thread;
+        std::atomic<bool> index_thread_stop{false};
+
+        // documents written in the compact schema, string schema documents may still be stored
+        // so queries match names in both forms
+        bool compact_documents = false;
+
+        // account_actions index, sequences are assigned on the writer thread only
+        bool store_account_actions = false;
+        std::map<account_name, int64_t> next_account_action_seq;
+
+        // ingest of transactions, traces, keys and account controls, see writer_loop
+        bool ingest = false;
+        uint32_t batch_size = 500;
+        fc::microseconds flush_interval = fc::milliseconds(250);
+        std::unique_ptr<boost::lockfree::spsc_queue<ingest_entry>> ingest_queue;
+        std::deque<ingest_entry> ingest_overflow;   ///< main thread only, entries that did not fit in the queue
+        size_t max_overflow = 0;   ///< hard bound of ingest_overflow, block application waits for the writer beyond it
+        uint64_t block_delay_logged = 0;
+        fc::microseconds max_block_delay = fc::milliseconds(100);   ///< most a backlog delays one block
+        std::thread writer_thread;
+        std::atomic<bool> writer_done{false};
+        std::mutex writer_mtx;
+        std::condition_variable writer_cv;
+
+        // irreversible only mode: traces of the block being applied (main thread), then of every
+        // reversible block on the current branch keyed by id, which orders them by block number
+        bool irreversible_only = false;
+        std::vector<chain::transaction_trace_ptr> pending_traces;
+        std::map<transaction_id_type, chain::transaction_metadata_ptr> pending_scheduled;   ///< deferred transactions of the block being applied
+        std::map<uint32_t, unconfirmed_block> unconfirmed_blocks;   ///< writer thread only, outside irreversible only mode
+        mutable std::mutex staging_mtx;
+        std::map<block_id_type, staged_block> staged_blocks;
+
+        void on_irreversible_block( const chain::block_state_ptr& bs );
+        void write_staged_through( uint32_t block_num );
+        boost::filesystem::path staged_blocks_file;   ///< reversible staged blocks kept across a restart
+        void save_staged_blocks();
+        void load_staged_blocks();
+        void write_block( staged_block& sb );
+        void remove_forked( mongocxx::database& db, uint32_t block_num );
+        uint32_t last_block_written = 0;   ///< main thread only, a block at or below it forks the written history,
+                                           ///< in irreversible only mode it was written before a restart
+        fc::optional<mongo_history_apis::read_only::get_transaction_result> find_staged_transaction( const string& id )const;
+        void add_staged_actions( const account_name& n, std::vector<mongo_history_apis::read_only::ordered_action_result>& out )const;
+
+        /// check a client out of the pool, it is returned when the entry goes out of scope
+        mongocxx::pool::entry acquire_client()const;
+        /// a client only if one is free right away, else an empty entry
+        mongocxx::pool::entry try_acquire_client()const;
+        mongocxx::pool::entry checked_out( mongocxx::pool::entry entry )const;
+
+        void on_applied_transaction( const chain::transaction_trace_ptr& t );
+        void on_action_trace( const chain::action_trace& at );
+        void on_system_action( const chain::action_trace& at );
+        void bootstrap_key_indices();
+        void load_synthetic_history( const synthetic_history_config& config );
+        void provision_indices();
+        bool check_query_plans( mongocxx::database& db );
+        void on_accepted_transaction( const chain::transaction_metadata_ptr& t );
+        void enqueue( ingest_entry&& e );
+        void drain_overflow();
+        void throttle_ingest();
+        void start_writer();
+        void stop_writer();
+        void writer_loop();
+        void write_with_retry( std::vector<ingest_entry>& batch );
+        bool write_batch( std::vector<ingest_entry>& batch, const types::b_date& now, bool retry );
+        bool write_store_batch( std::vector<ingest_entry>& batch, const types::b_date& now );
+        void remove_partial_batch( mongocxx::database& db, const std::vector<ingest_entry>& batch, const types::b_date& now );
+        void add_auth_ops( const chain::action_trace& at, mongocxx::bulk_write& key_ops, mongocxx::bulk_write& control_ops,
+                           bool& has_key_ops, bool& has_control_ops )const;
+        void add_account_actions( mongocxx::collection& account_actions, const chain::transaction_trace& t,
+                                  const chain::action_trace& at, std::vector<bsoncxx::document::value>& rows );
+        int64_t next_action_seq( mongocxx::collection& account_actions, const account_name& n );
+        /// account_action_seq of the next row stored for n, 0 for an account without rows
+        int64_t stored_action_seq_end( mongocxx::collection& account_actions, const account_name& n )const;
+        void append_name( bsoncxx::builder::basic::document& doc, const char* key, const name& n )const;
 
         static const std::string trans_col;
         static const std::string trans_traces_col;
         static const std::string pub_keys_col;
         static const std::string account_controls_col;
+        static const std::string account_actions_col;
     };
 
     const std::string mongo_history_plugin_impl::trans_col = "transactions";
     const std::string mongo_history_plugin_impl::trans_traces_col = "transaction_traces";
     const std::string mongo_history_plugin_impl::pub_keys_col = "pub_keys";
     const std::string mongo_history_plugin_impl::account_controls_col = "account_controls";
+    const std::string mongo_history_plugin_impl::account_actions_col = "account_actions";
+
+    mongocxx::pool::entry mongo_history_plugin_impl::acquire_client()const {
+        EOS_ASSERT( mongo_pool, chain::plugin_config_exception,
+                    "mongo_history_plugin has no MongoDB connection, no --history-mongodb-uri specified" );
+
+        auto entry = mongo_pool->try_acquire();
+        if( !entry ) {
+          // every client is checked out, wait for one to be returned
+          ++acquire_waits;
+          if( wait_queue_timeout == fc::microseconds() ) {
+            entry = mongo_pool->acquire();
+          } else {
+            const auto deadline = fc::time_point::now() + wait_queue_timeout;
+            auto backoff = std::chrono::microseconds(50);
+            while( !entry ) {
+              if( fc::time_point::now() >= deadline ) {
+                ++acquire_timeouts;
+                EOS_THROW( chain::plugin_exception,
+                           "Timed out after ${t}ms waiting for a MongoDB connection, all ${n} pooled connections are in use",
+                           ("t", wait_queue_timeout.count() / 1000)("n", pool_max_size) );
+              }
+              std::this_thread::sleep_for( backoff );
+              backoff = std::min( backoff * 2, std::chrono::microseconds(5000) );
+              entry = mongo_pool->try_acquire();
+            }
+          }
+        }
+        return checked_out( std::move( *entry ) );
+    }
+
+    mongocxx::pool::entry mongo_history_plugin_impl::try_acquire_client()const {
+        if( !mongo_pool ) return mongocxx::pool::entry();
+        auto entry = mongo_pool->try_acquire();
+        if( !entry ) return mongocxx::pool::entry();
+        return checked_out( std::move( *entry ) );
+    }
+
+    mongocxx::pool::entry mongo_history_plugin_impl::checked_out( mongocxx::pool::entry entry )const {
+        auto in_use = ++clients_in_use;
+        auto peak = clients_peak.load();
+        while( in_use > peak && !clients_peak.compare_exchange_weak( peak, in_use ) ) {}
+
+        if( in_use >= pool_max_size ) {
+          // report saturation at most once every 10 seconds
+          auto now = fc::time_point::now().time_since_epoch().count();
+          auto last = last_saturation_log.load();
+          if( now - last > fc::seconds(10).count() && last_saturation_log.compare_exchange_strong( last, now ) ) {
+            wlog( "MongoDB connection pool saturated: ${u}/${m} in use, ${w} waits, ${t} timeouts",
+                  ("u", in_use)("m", pool_max_size)("w", acquire_waits.load())("t", acquire_timeouts.load()) );
+          }
+        }
+
+        // wrap the pool's deleter so the in-use count follows the client back into the pool
+        auto release = entry.get_deleter();
+        return mongocxx::pool::entry( entry.release(), [this, release]( mongocxx::client* c ) {
+          --clients_in_use;
+          release( c );
+        });
+    }
+
+    namespace {
+      /// value of a name field in a query matching any of names, in both representations when dual
+      bsoncxx::document::value names_match( const std::vector<account_name>& names, bool dual ) {
+        if( names.size() == 1 ) return compact_schema::name_match( names.front(), dual );
+        bsoncxx::builder::basic::array in;
+        for( const auto& n : names ) {
+          in.append( n.to_string() );
+          if( dual ) in.append( types::b_int64{ int64_t( n.value ) } );
+        }
+        return make_document( kvp( "$in", in ) );
+      }
+
+      /// transaction_traces with a top level action trace involving one of names, from the document of from["id"] on in sort order
+      bsoncxx::document::value traced_actions_query( const std::vector<account_name>& names, bool dual, int32_t sort,
+                                                     const fc::optional<bsoncxx::document::value>& from ) {
+        const auto name_value = names_match( names, dual );
+        auto query = make_document( kvp( "$or", make_array(
+              make_document( kvp( "action_traces.act.authorization.actor", name_value.view() )),
+              make_document( kvp( "action_traces.inline_traces.receipt.receiver", name_value.view() )),
+              make_document( kvp( "action_traces.receipt.receiver", name_value.view() ))
+              )));
+        if( !from ) return query;
+        return make_document( kvp( "$and", make_array(
+              query.view(),
+              make_document( kvp( "_id", make_document( kvp( sort > 0 ? "$gte" : "$lte", from->view()["id"].get_value() ))))
+              )));
+      }
+
+      /// history_backend over the MongoDB collections, sharing the connection pool with the MongoDB specific plans
+      class mongo_backend : public history_backend {
+        public:
+          explicit mongo_backend( const mongo_history_plugin_impl& h )
+          :history( h ) {}
+
+          void scan_traces( const trace_scan& scan, const document_visitor& visit )const override {
+            auto client = history.acquire_client();
+            auto trans_trace = (*client)[history.db_name][history.trans_traces_col];
+            mongocxx::options::find opts;
+            opts.sort( make_document( kvp( "_id", scan.sort )));
+            if( scan.skip ) opts.skip( int64_t( scan.skip ));
+            if( scan.max_time.count() ) opts.max_time( scan.max_time );
+            opts.projection( make_document( kvp( "schema", 1 ), kvp( "action_traces", 1 )));
+            const auto& accounts = scan.accounts.empty() ? std::vector<account_name>{ scan.account } : scan.accounts;
+            auto query = traced_actions_query( accounts, history.compact_documents, scan.sort, scan.from_id );
+            for( auto&& doc : trans_trace.find( query.view(), opts ) ) {
+              if( !visit( doc ) ) return;
+            }
+          }
+
+          /// traces joined with their transaction in one round trip
+          std::vector<bsoncxx::document::value> find_transaction_traces( const std::string& id, size_t limit )const override {
+            // a full id is a point read, a prefix a range read: every id with the prefix sorts in [prefix, prefix + "g")
+            bsoncxx::document::value id_query = id.size() == 64
+                  ? make_document( kvp( "id", id ))
+                  : make_document( kvp( "id", make_document( kvp( "$gte", id ), kvp( "$lt", id + "g" ))));
+            auto client = history.acquire_client();
+            auto trans_trace = (*client)[history.db_name][history.trans_traces_col];
+            mongocxx::pipeline pipeline;
+            pipeline.match( id_query.view() );
+            pipeline.limit( int32_t( limit ));
+            pipeline.lookup( make_document( kvp( "from", history.trans_col ),
+                                            kvp( "localField", "id" ),
+                                            kvp( "foreignField", "trx_id" ),
+                                            kvp( "as", "trx" )));
+            std::vector<bsoncxx::document::value> result;
+            for( auto&& doc : trans_trace.aggregate( pipeline ) ) {
+              result.emplace_back( doc );
+            }
+            return result;
+          }
+
+          /// one pass over transaction_traces grouped on the server, the accounts are streamed without a size limit
+          void for_each_trace_account( const std::function<void( uint64_t )>& f )const override {
+            // names of the matched fields as one array per document: the authorization and inline
+            // receiver paths yield an array per action trace, flattened with $reduce
+            auto flatten = []( const char* path ) {
+              return make_document( kvp( "$reduce", make_document(
+                    kvp( "input", path ),
+                    kvp( "initialValue", make_array() ),
+                    kvp( "in", make_document( kvp( "$concatArrays", make_array( "$$value", "$$this" ) ) ) ) ) ) );
+            };
+            mongocxx::pipeline pipeline;
+            pipeline.project( make_document( kvp( "_id", 0 ), kvp( "a", make_document( kvp( "$concatArrays", make_array(
+                  "$action_traces.receipt.receiver",
+                  flatten( "$action_traces.act.authorization.actor" ),
+                  flatten( "$action_traces.inline_traces.receipt.receiver" ) ) ) ) ) ) );
+            pipeline.unwind( "$a" );
+            pipeline.group( make_document( kvp( "_id", "$a" ) ) );
+            for_each_group( history.trans_traces_col, pipeline, f );
+          }
+
+          /// the accounts with account_actions rows, grouped along the account index
+          void for_each_action_account( const std::function<void( uint64_t )>& f )const override {
+            mongocxx::pipeline pipeline;
+            pipeline.sort( make_document( kvp( "account", 1 ) ) );
+            pipeline.group( make_document( kvp( "_id", "$account" ) ) );
+            for_each_group( history.account_actions_col, pipeline, f );
+          }
+
+          void for_each_pub_key( const document_visitor& visit )const override {
+            for_each( history.pub_keys_col, visit );
+          }
+
+          void for_each_account_control( const document_visitor& visit )const override {
+            for_each( history.account_controls_col, visit );
+          }
+
+        private:
+          /// calls f with the name value of the _id of every group, the groups may spill to disk on the server
+          void for_each_group( const std::string& col, const mongocxx::pipeline& pipeline,
+                               const std::function<void( uint64_t )>& f )const {
+            mongocxx::options::aggregate opts;
+            opts.allow_disk_use( true );
+            opts.batch_size( 10000 );
+            auto client = history.acquire_client();
+            for( auto&& doc : (*client)[history.db_name][col].aggregate( pipeline, opts ) ) {
+              auto v = doc["_id"];
+              if( v && (v.type() == type::k_utf8 || v.type() == type::k_int64) )
+                f( compact_schema::to_name( v ).value );
+            }
+          }
+
+          void for_each( const std::string& col, const document_visitor& visit )const {
+            auto client = history.acquire_client();
+            for( auto&& doc : (*client)[history.db_name][col].find( make_document() ) ) {
+              if( !visit( doc ) ) return;
+            }
+          }
+
+          const mongo_history_plugin_impl& history;
+      };
+    }
+
+    namespace {
+      template<typename MultiIndex, typename LookupType>
+      void remove( chainbase::database& db, const account_name& account_name, const permission_name& permission ) {
+        const auto& idx = db.get_index<MultiIndex, LookupType>();
+        auto& mutable_idx = db.get_mutable_index<MultiIndex>();
+        while( !idx.empty() ) {
+          auto key = boost::make_tuple( account_name, permission );
+          const auto& itr = idx.lower_bound( key );
+          if( itr == idx.end() )
+            break;
+          const auto& range_end = idx.upper_bound( key );
+          if( itr == range_end )
+            break;
+          mutable_idx.remove( *itr );
+        }
+      }
+
+      void add( chainbase::database& db, const vector<key_weight>& keys, const account_name& name, const permission_name& permission ) {
+        for( const auto& pub_key_weight : keys ) {
+          db.create<public_key_history_object>( [&]( public_key_history_object& obj ) {
+            obj.public_key = pub_key_weight.key;
+            obj.name = name;
+            obj.permission = permission;
+          });
+        }
+      }
+
+      void add( chainbase::database& db, const vector<permission_level_weight>& controller_accounts,
+                const account_name& account_name, const permission_name& permission ) {
+        for( const auto& controlling_account : controller_accounts ) {
+          db.create<account_control_history_object>( [&]( account_control_history_object& obj ) {
+            obj.controlled_account = account_name;
+            obj.controlled_permission = permission;
+            obj.controlling_account = controlling_account.permission.actor;
+          });
+        }
+      }
+    }
+
+    void mongo_history_plugin_impl::on_applied_transaction( const chain::transaction_trace_ptr& t ) {
+        // failed transactions too, whatever mongo_db_plugin stores must pass the filter
+        if( account_filter ) {
+          for( const auto& atrace : t->action_traces ) {
+            add_trace_accounts( atrace );
+          }
+        }
+        if( !t->receipt || (t->receipt->status != transaction_receipt_header::executed &&
+                            t->receipt->status != transaction_receipt_header::soft_fail) )
+          return;
+        for( const auto& atrace : t->action_traces ) {
+          on_action_trace( atrace );
+        }
+        // speculative runs and blocks that are never accepted are dropped in on_accepted_block
+        if( ingest_queue )
+          pending_traces.emplace_back( t );
+    }
+
+    void mongo_history_plugin_impl::on_accepted_transaction( const chain::transaction_metadata_ptr& t ) {
+        // transactions are written from the receipts of their accepted block, which carry only the id of a deferred one
+        if( t->scheduled )
+          pending_scheduled[t->id] = t;
+    }
+
+    void mongo_history_plugin_impl::enqueue( ingest_entry&& e ) {
+        // entries that did not fit stay ahead of newer ones
+        ingest_overflow.emplace_back( std::move( e ) );
+        drain_overflow();
+        if( ingest_overflow.size() < max_overflow ) return;
+        // bounded memory: only a writer this far behind makes block application wait
+        wlog( "mongo_history_plugin ingest ${n} entries behind, waiting for the writer", ("n", ingest_overflow.size()) );
+        while( ingest_overflow.size() >= max_overflow ) {
+          std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+          drain_overflow();
+        }
+    }
+
+    void mongo_history_plugin_impl::drain_overflow() {
+        while( !ingest_overflow.empty() && ingest_queue->push( ingest_overflow.front() ) ) {
+          ingest_overflow.pop_front();
+        }
+        writer_cv.notify_one();
+    }
+
+    void mongo_history_plugin_impl::throttle_ingest() {
+        drain_overflow();
+        if( ingest_overflow.empty() ) return;
+        // the writer is behind, slow block application down in proportion instead of stalling it
+        const int64_t delay_us = std::min( max_block_delay.count(),
+                                           max_block_delay.count() * int64_t( ingest_overflow.size() ) / int64_t( max_overflow ) );
+        if( block_delay_logged++ % 100 == 0 )
+          wlog( "mongo_history_plugin ingest queue full, ${n} entries waiting, delaying blocks by ${d}us",
+                ("n", ingest_overflow.size())("d", delay_us) );
+        std::this_thread::sleep_for( std::chrono::microseconds( delay_us ) );
+    }
+
+    void mongo_history_plugin_impl::start_writer() {
+        writer_done = false;
+        writer_thread = std::thread( [this] { writer_loop(); } );
+    }
+
+    void mongo_history_plugin_impl::stop_writer() {
+        if( !writer_thread.joinable() ) return;
+        while( !ingest_overflow.empty() ) {
+          if( ingest_queue->push( ingest_overflow.front() ) ) {
+            ingest_overflow.pop_front();
+          } else {
+            writer_cv.notify_one();
+            std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+          }
+        }
+        writer_done = true;
+        writer_cv.notify_one();
+        writer_thread.join();
+    }
+
+    void mongo_history_plugin_impl::writer_loop() {
+        std::vector<ingest_entry> batch;
+        batch.reserve( batch_size );
+        auto last_flush = fc::time_point::now();
+        // traces and transactions are followed by the end of their block, a batch is cut after it
+        auto in_block = []( const ingest_entry& e ) { return e.trace || e.trx; };
+        while( true ) {
+          const bool done = writer_done;
+          ingest_entry e;
+          // a block larger than a batch is written whole
+          while( (batch.size() < batch_size || in_block( batch.back() )) && ingest_queue->pop( e ) ) {
+            batch.emplace_back( std::move( e ) );
+          }
+          // entries of a block not completely queued yet wait for the next batch
+          size_t cut = batch.size();
+          while( cut > 0 && in_block( batch[cut - 1] ) ) --cut;
+          const bool full = batch.size() >= batch_size && cut == batch.size();
+          if( cut > 0 && (full || done || fc::time_point::now() - last_flush >= flush_interval) ) {
+            std::vector<ingest_entry> ready( std::make_move_iterator( batch.begin() ), std::make_move_iterator( batch.begin() + cut ) );
+            batch.erase( batch.begin(), batch.begin() + cut );
+            write_with_retry( ready );
+            last_flush = fc::time_point::now();
+          }
+          if( full ) continue;
+          if( done ) {
+            if( ingest_queue->read_available() == 0 ) break;
+            continue;
+          }
+          std::unique_lock<std::mutex> lock( writer_mtx );
+          writer_cv.wait_for( lock, std::chrono::microseconds( flush_interval.count() ) );
+        }
+    }
+
+    /// lowest block a batch writes history of or takes history back from
+    static uint32_t first_block( const std::vector<ingest_entry>& batch ) {
+        uint32_t first = std::numeric_limits<uint32_t>::max();
+        for( const auto& e : batch ) {
+          if( e.forked_from ) first = std::min( first, e.forked_from );
+          if( e.trace ) first = std::min( first, e.trace->block_num );
+          if( e.block_num ) first = std::min( first, e.block_num );
+        }
+        return first;
+    }
+
+    void mongo_history_plugin_impl::write_with_retry( std::vector<ingest_entry>& batch ) {
+        // a failed batch is written again instead of dropped. Meanwhile the queue fills up and
+        // throttle_ingest slows block application down until, beyond max_overflow, it waits
+        const auto now = types::b_date{ std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::system_clock::now().time_since_epoch() ) };
+        auto backoff = std::chrono::milliseconds( 100 );
+        for( uint32_t attempt = 1; ; ++attempt ) {
+          if( store ? write_store_batch( batch, now ) : write_batch( batch, now, attempt > 1 ) ) return;
+          if( writer_done && attempt >= 3 ) {
+            elog( "Dropping ${n} history entries of blocks from ${b} on at shutdown, replay the chain to write them",
+                  ("n", batch.size())("b", first_block( batch )) );
+            return;
+          }
+          wlog( "Writing ${n} history entries again in ${d}ms", ("n", batch.size())("d", backoff.count()) );
+          std::this_thread::sleep_for( backoff );
+          backoff = std::min( backoff * 2, std::chrono::milliseconds( 10000 ) );
+        }
+    }
+
+    bool mongo_history_plugin_impl::write_batch( std::vector<ingest_entry>& batch, const types::b_date& now, bool retry ) {
+        // a failed batch is written again from the reversible history it started with
+        auto unconfirmed = unconfirmed_blocks;
+        try {
+          auto client = acquire_client();
+          auto db = (*client)[db_name];
+          auto account_actions = db[account_actions_col];
+          if( retry ) remove_partial_batch( db, batch, now );
+
+          std::vector<bsoncxx::document::value> trx_docs;
+          std::vector<bsoncxx::document::value> trace_docs;
+          std::vector<bsoncxx::document::value> action_rows;
+          mongocxx::options::bulk_write ordered;
+          ordered.ordered( true );
+          mongocxx::bulk_write key_ops{ ordered };
+          mongocxx::bulk_write control_ops{ ordered };
+          bool has_key_ops = false;
+          bool has_control_ops = false;
+
+          auto flush = [&]() {
+            mongocxx::options::insert unordered;
+            unordered.ordered( false );
+            if( !trx_docs.empty() ) db[trans_col].insert_many( trx_docs, unordered );
+            if( !trace_docs.empty() ) db[trans_traces_col].insert_many( trace_docs, unordered );
+            if( !action_rows.empty() ) account_actions.insert_many( action_rows, unordered );
+            if( has_key_ops ) db[pub_keys_col].bulk_write( key_ops );
+            if( has_control_ops ) db[account_controls_col].bulk_write( control_ops );
+            trx_docs.clear();
+            trace_docs.clear();
+            action_rows.clear();
+            key_ops = mongocxx::bulk_write{ ordered };
+            control_ops = mongocxx::bulk_write{ ordered };
+            has_key_ops = false;
+            has_control_ops = false;
+          };
+
+          auto add_trace_auth_ops = [&]( const chain::transaction_trace& t ) {
+            for( const auto& atrace : t.action_traces ) {
+              add_auth_ops( atrace, key_ops, control_ops, has_key_ops, has_control_ops );
+            }
+          };
+
+          for( const auto& e : batch ) {
+            if( e.forked_from ) {
+              // everything before the fork is written first, sequences continue from what remains
+              flush();
+              remove_forked( db, e.forked_from );
+            }
+            if( e.irreversible ) {
+              auto end = unconfirmed_blocks.upper_bound( e.irreversible );
+              for( auto itr = unconfirmed_blocks.begin(); itr != end; ++itr ) {
+                for( const auto& t : itr->second.traces ) add_trace_auth_ops( *t );
+              }
+              unconfirmed_blocks.erase( unconfirmed_blocks.begin(), end );
+            }
+            if( e.trx ) {
+              trx_docs.emplace_back( transaction_document( e.trx->packed_trx.get_signed_transaction(), e.trx->id,
+                                                           e.trx->accepted, e.trx->implicit, e.trx->scheduled, now ) );
+              if( !irreversible_only ) unconfirmed_blocks[e.block_num].trx_ids.push_back( e.trx->id );
+            }
+            if( e.trace ) {
+              if( ingest ) {
+                trace_docs.emplace_back( trace_document( *e.trace, compact_documents, now ) );
+                // pub_keys and account_controls have no block number to take changes back by
+                if( irreversible_only ) add_trace_auth_ops( *e.trace );
+                else unconfirmed_blocks[e.trace->block_num].traces.push_back( e.trace );
+              }
+              if( store_account_actions ) {
+                for( const auto& atrace : e.trace->action_traces ) {
+                  add_account_actions( account_actions, *e.trace, atrace, action_rows );
+                }
+              }
+            }
+          }
+
+          flush();
+          return true;
+        } catch( mongocxx::bulk_write_exception& e ) {
+          elog( "Failed to write ${n} history entries: ${e}", ("n", batch.size())("e", e.what()) );
+        } catch( mongocxx::exception& e ) {
+          elog( "Failed to write ${n} history entries: ${e}", ("n", batch.size())("e", e.what()) );
+        } catch( bsoncxx::exception& e ) {
+          elog( "Failed to convert ${n} history entries: ${e}", ("n", batch.size())("e", e.what()) );
+        } catch( fc::exception& e ) {
+          elog( "Failed to write ${n} history entries: ${e}", ("n", batch.size())("e", e.to_string()) );
+        }
+        unconfirmed_blocks = std::move( unconfirmed );
+        // sequences handed to rows that were not written are handed out again
+        next_account_action_seq.clear();
+        return false;
+    }
+
+    void mongo_history_plugin_impl::remove_partial_batch( mongocxx::database& db, const std::vector<ingest_entry>& batch,
+                                                          const types::b_date& now ) {
+        // batches hold whole blocks, documents of the batch's blocks were written by the failed attempt.
+        // Transactions are matched by the creation time of the attempts too, an id may be in an earlier block
+        const auto from = make_document( kvp( "block_num", make_document( kvp( "$gte", int64_t( first_block( batch ) ) ) ) ) );
+        if( ingest ) {
+          db[trans_traces_col].delete_many( from.view() );
+          bsoncxx::builder::basic::array ids;
+          for( const auto& e : batch ) {
+            if( e.trx ) ids.append( e.trx->id.str() );
+          }
+          db[trans_col].delete_many( make_document( kvp( "trx_id", make_document( kvp( "$in", ids.extract() ) ) ), kvp( "createdAt", now ) ) );
+        }
+        // rows are numbered again from what the earlier batches stored, see next_action_seq
+        if( store_account_actions )
+          db[account_actions_col].delete_many( from.view() );
+    }
+
+    void mongo_history_plugin_impl::remove_forked( mongocxx::database& db, uint32_t block_num ) {
+        const auto from = make_document( kvp( "block_num", make_document( kvp( "$gte", int64_t( block_num ) ) ) ) );
+        int64_t removed = 0;
+        if( ingest ) {
+          auto r = db[trans_traces_col].delete_many( from.view() );
+          if( r ) removed += r->deleted_count();
+          // transactions are removed by id, the new branch usually includes most of them again
+          bsoncxx::builder::basic::array ids;
+          auto forked = unconfirmed_blocks.lower_bound( block_num );
+          for( auto itr = forked; itr != unconfirmed_blocks.end(); ++itr ) {
+            for( const auto& id : itr->second.trx_ids ) ids.append( id.str() );
+          }
+          unconfirmed_blocks.erase( forked, unconfirmed_blocks.end() );
+          auto t = db[trans_col].delete_many( make_document( kvp( "trx_id", make_document( kvp( "$in", ids.extract() ) ) ) ) );
+          if( t ) removed += t->deleted_count();
+        }
+        if( store_account_actions ) {
+          auto r = db[account_actions_col].delete_many( from.view() );
+          if( r ) removed += r->deleted_count();
+          next_account_action_seq.clear();
+        }
+        ilog( "Removed ${n} history documents of blocks from ${b} on, forked out", ("n", removed)("b", block_num) );
+    }
+
+    bool mongo_history_plugin_impl::write_store_batch( std::vector<ingest_entry>& batch, const types::b_date& now ) {
+        // a failed append leaves the store at its last commit, the batch is simply appended again
+        try {
+          std::vector<bsoncxx::document::value> trx_docs;
+          std::vector<bsoncxx::document::value> trace_docs;
+          uint32_t last_block = 0;   // batches end with a block, see writer_loop
+          for( const auto& e : batch ) {
+            // only irreversible blocks are queued for the store, see write_block
+            EOS_ASSERT( !e.forked_from, chain::plugin_exception, "history store cannot take back blocks from ${b} on", ("b", e.forked_from) );
+            if( e.trx ) {
+              trx_docs.emplace_back( transaction_document( e.trx->packed_trx.get_signed_transaction(), e.trx->id,
+                                                           e.trx->accepted, e.trx->implicit, e.trx->scheduled, now ) );
+            }
+            if( e.trace )
+              trace_docs.emplace_back( trace_document( *e.trace, compact_documents, now ) );
+            if( e.ends_block() )
+              last_block = e.block_num;
+          }
+          if( last_block != 0 ) store->append( trx_docs, trace_docs, last_block );
+          return true;
+        } catch( bsoncxx::exception& e ) {
+          elog( "Failed to convert ${n} history entries: ${e}", ("n", batch.size())("e", e.what()) );
+        } catch( fc::exception& e ) {
+          elog( "Failed to store ${n} history entries: ${e}", ("n", batch.size())("e", e.to_string()) );
+        }
+        return false;
+    }
+
+    void mongo_history_plugin_impl::add_auth_ops( const chain::action_trace& at, mongocxx::bulk_write& key_ops,
+                                                  mongocxx::bulk_write& control_ops, bool& has_key_ops, bool& has_control_ops )const {
+        // mirrors on_system_action for the pub_keys and account_controls collections. Documents are
+        // upserted, a batch written again after a failure replays its operations without duplicates
+        auto upsert = []( bsoncxx::document::value doc ) {
+          mongocxx::model::replace_one op{ bsoncxx::document::value( doc ), std::move( doc ) };
+          op.upsert( true );
+          return op;
+        };
+        auto add_keys = [&]( const vector<key_weight>& keys, const account_name& name, const permission_name& permission ) {
+          for( const auto& pub_key_weight : keys ) {
+            bsoncxx::builder::basic::document doc;
+            append_name( doc, "account", name );
+            doc.append( kvp( "public_key", string( pub_key_weight.key ) ) );
+            append_name( doc, "permission", permission );
+            key_ops.append( upsert( doc.extract() ) );
+            has_key_ops = true;
+          }
+        };
+        auto add_controls = [&]( const vector<permission_level_weight>& accounts, const account_name& name, const permission_name& permission ) {
+          for( const auto& controlling_account : accounts ) {
+            bsoncxx::builder::basic::document doc;
+            append_name( doc, "controlled_account", name );
+            append_name( doc, "controlled_permission", permission );
+            append_name( doc, "controlling_account", controlling_account.permission.actor );
+            control_ops.append( upsert( doc.extract() ) );
+            has_control_ops = true;
+          }
+        };
+        auto remove_authority = [&]( const account_name& name, const permission_name& permission ) {
+          key_ops.append( mongocxx::model::delete_many{ make_document( kvp( "account", compact_schema::name_match( name, compact_documents ) ),
+                                                                       kvp( "permission", compact_schema::name_match( permission, compact_documents ) ) ) } );
+          control_ops.append( mongocxx::model::delete_many{ make_document( kvp( "controlled_account", compact_schema::name_match( name, compact_documents ) ),
+                                                                           kvp( "controlled_permission", compact_schema::name_match( permission, compact_documents ) ) ) } );
+          has_key_ops = true;
+          has_control_ops = true;
+        };
+
+        if( at.receipt.receiver == chain::config::system_account_name ) {
+          if( at.act.name == N(newaccount) ) {
+            const auto create = at.act.data_as<chain::newaccount>();
+            add_keys( create.owner.keys, create.name, N(owner) );
+            add_controls( create.owner.accounts, create.name, N(owner) );
+            add_keys( create.active.keys, create.name, N(active) );
+            add_controls( create.active.accounts, create.name, N(active) );
+          } else if( at.act.name == N(updateauth) ) {
+            const auto update = at.act.data_as<chain::updateauth>();
+            remove_authority( update.account, update.permission );
+            add_keys( update.auth.keys, update.account, update.permission );
+            add_controls( update.auth.accounts, update.account, update.permission );
+          } else if( at.act.name == N(deleteauth) ) {
+            const auto del = at.act.data_as<chain::deleteauth>();
+            remove_authority( del.account, del.permission );
+          }
+        }
+        for( const auto& iline : at.inline_traces ) {
+          add_auth_ops( iline, key_ops, control_ops, has_key_ops, has_control_ops );
+        }
+    }
+
+    void mongo_history_plugin_impl::load_synthetic_history( const synthetic_history_config& config ) {
+        ilog( "Generating ${t} synthetic transactions over ${a} accounts", ("t", config.transactions)("a", config.accounts) );
+        auto memory = std::make_unique<memory_history_backend>();
+        const auto now = types::b_date{ std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::system_clock::now().time_since_epoch() ) };
+        synthetic_history synthetic( config );
+        synthetic.for_each_transaction( [&]( const chain::signed_transaction& trx, const chain::transaction_trace& trace ) {
+          memory->add_transaction( transaction_document( trx, trace.id, true, false, false, now ).view() );
+          memory->add_trace( trace_document( trace, compact_documents, now ).view() );
+        });
+        synthetic.for_each_key( [&]( const account_name& n, const permission_name& permission, const public_key_type& key ) {
+          bsoncxx::builder::basic::document doc;
+          append_name( doc, "account", n );
+          doc.append( kvp( "public_key", string( key ) ) );
+          append_name( doc, "permission", permission );
+          memory->add_pub_key( doc.view() );
+        });
+        synthetic.for_each_control( [&]( const account_name& n, const permission_name& permission, const account_name& controlling ) {
+          bsoncxx::builder::basic::document doc;
+          append_name( doc, "controlled_account", n );
+          append_name( doc, "controlled_permission", permission );
+          append_name( doc, "controlling_account", controlling );
+          memory->add_account_control( doc.view() );
+        });
+        ilog( "Generated ${n} synthetic transaction traces", ("n", memory->trace_count()) );
+        backend = std::move( memory );
+    }
+
+    void mongo_history_plugin_impl::add_trace_accounts( const chain::action_trace& at ) {
+        account_filter->add( at.receipt.receiver.value );
+        for( const auto& auth : at.act.authorization ) {
+          account_filter->add( auth.actor.value );
+        }
+        for( const auto& iline : at.inline_traces ) {
+          add_trace_accounts( iline );
+        }
+    }
+
+    void mongo_history_plugin_impl::load_account_filter() {
+        try {
+          ilog( "Loading accounts with history" );
+          auto add = [&]( uint64_t account ) { account_filter->add( account ); };
+          // get_actions is answered from account_actions then, its accounts are the ones with history
+          if( store_account_actions )
+            backend->for_each_action_account( add );
+          else
+            backend->for_each_trace_account( add );
+          account_filter_loaded.store( true, std::memory_order_release );
+          ilog( "Loaded about ${n} accounts with history", ("n", account_filter->estimated_size()) );
+        } catch( mongocxx::exception& e ) {
+          wlog( "Unable to load accounts with history, every get_actions is queried: ${e}", ("e", e.what()) );
+        } catch( fc::exception& e ) {
+          wlog( "Unable to load accounts with history, every get_actions is queried: ${e}", ("e", e.to_string()) );
+        }
+    }
+
+    void mongo_history_plugin_impl::on_action_trace( const chain::action_trace& at ) {
+        if( at.receipt.receiver == chain::config::system_account_name )
+          on_system_action( at );
+        for( const auto& iline : at.inline_traces ) {
+          on_action_trace( iline );
+        }
+    }
+
+    void mongo_history_plugin_impl::on_system_action( const chain::action_trace& at ) {
+        auto& chain = chain_plug->chain();
+        chainbase::database& db = const_cast<chainbase::database&>( chain.db() ); // Override read-only access to state DB (highly unrecommended practice!)
+        if( at.act.name == N(newaccount) ) {
+          const auto create = at.act.data_as<chain::newaccount>();
+          add( db, create.owner.keys, create.name, N(owner) );
+          add( db, create.owner.accounts, create.name, N(owner) );
+          add( db, create.active.keys, create.name, N(active) );
+          add( db, create.active.accounts, create.name, N(active) );
+        } else if( at.act.name == N(updateauth) ) {
+          const auto update = at.act.data_as<chain::updateauth>();
+          remove<public_key_history_multi_index, by_account_permission>( db, update.account, update.permission );
+          remove<account_control_history_multi_index, by_controlled_authority>( db, update.account, update.permission );
+          add( db, update.auth.keys, update.account, update.permission );
+          add( db, update.auth.accounts, update.account, update.permission );
+        } else if( at.act.name == N(deleteauth) ) {
+          const auto del = at.act.data_as<chain::deleteauth>();
+          remove<public_key_history_multi_index, by_account_permission>( db, del.account, del.permission );
+          remove<account_control_history_multi_index, by_controlled_authority>( db, del.account, del.permission );
+        }
+    }
+
+    namespace {
+      /// explain output: true if the plan or one of its input stages scans the whole collection
+      bool has_collscan( const bsoncxx::document::view& stage ) {
+        auto name = stage["stage"];
+        if( name && name.type() == type::k_utf8 && name.get_utf8().value.to_string() == "COLLSCAN" ) return true;
+        auto input = stage["inputStage"];
+        if( input && input.type() == type::k_document && has_collscan( input.get_document().value ) ) return true;
+        auto inputs = stage["inputStages"];
+        if( inputs && inputs.type() == type::k_array ) {
+          for( auto in : inputs.get_array().value ) {
+            if( in.type() == type::k_document && has_collscan( in.get_document().value ) ) return true;
+          }
+        }
+        return false;
+      }
+    }
+
+    /**
+     *  Create the indices the read_only API relies on, then check that every query shape it issues
+     *  is answered from an index. Runs on index_thread so the node does not wait for index builds.
+     */
+    void mongo_history_plugin_impl::provision_indices() {
+        try {
+          auto client = acquire_client();
+          auto db = (*client)[db_name];
+          if( create_indices ) {
+            struct index_spec {
+              const std::string&        col;
+              bsoncxx::document::value  keys;
+              bool                      unique;
+            };
+            std::vector<index_spec> specs;
+            specs.push_back( {trans_traces_col, make_document( kvp( "action_traces.act.authorization.actor", 1 ) ), false} );
+            specs.push_back( {trans_traces_col, make_document( kvp( "action_traces.inline_traces.receipt.receiver", 1 ) ), false} );
+            specs.push_back( {trans_traces_col, make_document( kvp( "action_traces.receipt.receiver", 1 ) ), false} );
+            // full id and id prefix lookups of get_transaction
+            specs.push_back( {trans_traces_col, make_document( kvp( "id", 1 ) ), false} );
+            specs.push_back( {trans_col, make_document( kvp( "trx_id", 1 ) ), false} );
+            specs.push_back( {pub_keys_col, make_document( kvp( "public_key", 1 ) ), false} );
+            specs.push_back( {pub_keys_col, make_document( kvp( "account", 1 ), kvp( "permission", 1 ) ), false} );
+            specs.push_back( {account_controls_col, make_document( kvp( "controlling_account", 1 ) ), false} );
+            specs.push_back( {account_controls_col, make_document( kvp( "controlled_account", 1 ), kvp( "controlled_permission", 1 ) ), false} );
+            if( store_account_actions )
+              specs.push_back( {account_actions_col, make_document( kvp( "account", 1 ), kvp( "account_action_seq", 1 ) ), true} );
+            // history of forked out blocks and of failed batches is removed by block number
+            if( store_account_actions )
+              specs.push_back( {account_actions_col, make_document( kvp( "block_num", 1 ) ), false} );
+            if( ingest )
+              specs.push_back( {trans_traces_col, make_document( kvp( "block_num", 1 ) ), false} );
+
+            for( const auto& spec : specs ) {
+              if( index_thread_stop ) return;
+              mongocxx::options::index opts;
+              opts.background( true );
+              if( spec.unique ) opts.unique( true );
+              try {
+                db[spec.col].create_index( spec.keys.view(), opts );
+              } catch( mongocxx::exception& e ) {
+                wlog( "Unable to create index ${k} on ${c}: ${e}", ("k", bsoncxx::to_json( spec.keys.view() ))("c", spec.col)("e", e.what()) );
+              }
+            }
+          }
+          if( index_check != index_check_mode::off && !index_thread_stop && !check_query_plans( db ) &&
+              index_check == index_check_mode::require ) {
+            elog( "history-mongodb-index-check = require and a history query would scan a whole collection, shutting down" );
+            app().quit();
+          }
+        } catch( mongocxx::exception& e ) {
+          elog( "Unable to provision history indices: ${e}", ("e", e.what()) );
+        } catch( fc::exception& e ) {
+          elog( "Unable to provision history indices: ${e}", ("e", e.to_string()) );
+        }
+    }
+
+    /// explain every query shape of the read_only API, false if one of them scans a whole collection
+    bool mongo_history_plugin_impl::check_query_plans( mongocxx::database& db ) {
+        const account_name sample = chain::config::system_account_name;
+        const auto name_value = compact_schema::name_match( sample, compact_documents );
+        const std::string sample_id( 64, '0' );
+        struct query_shape {
+          const char*               what;
+          const std::string&        col;
+          bsoncxx::document::value  filter;
+          bsoncxx::document::value  sort;
+        };
+        std::vector<query_shape> shapes;
+        shapes.push_back( {"get_actions", trans_traces_col,
+                           make_document( kvp( "$or", make_array(
+                                 make_document( kvp( "action_traces.act.authorization.actor", name_value.view() ) ),
+                                 make_document( kvp( "action_traces.inline_traces.receipt.receiver", name_value.view() ) ),
+                                 make_document( kvp( "action_traces.receipt.receiver", name_value.view() ) ) ) ) ),
+                           make_document( kvp( "_id", -1 ) )} );
+        shapes.push_back( {"get_transaction by id", trans_traces_col, make_document( kvp( "id", sample_id ) ), make_document()} );
+        shapes.push_back( {"get_transaction by id prefix", trans_traces_col,
+                           make_document( kvp( "id", make_document( kvp( "$gte", sample_id.substr( 0, 8 ) ), kvp( "$lt", sample_id.substr( 0, 8 ) + "g" ) ) ) ),
+                           make_document()} );
+        shapes.push_back( {"get_transaction trx lookup", trans_col, make_document( kvp( "trx_id", sample_id ) ), make_document()} );
+        // get_key_accounts and get_controlled_accounts read the state database, the ingest writer
+        // replaces the keys and controls of a permission in these collections
+        if( ingest ) {
+          shapes.push_back( {"ingest key removal", pub_keys_col,
+                             make_document( kvp( "account", name_value.view() ), kvp( "permission", name_value.view() ) ), make_document()} );
+          shapes.push_back( {"ingest control removal", account_controls_col,
+                             make_document( kvp( "controlled_account", name_value.view() ), kvp( "controlled_permission", name_value.view() ) ),
+                             make_document()} );
+        }
+        if( store_account_actions )
+          shapes.push_back( {"get_actions from account_actions", account_actions_col,
+                             make_document( kvp( "account", name_value.view() ),
+                                            kvp( "account_action_seq", make_document( kvp( "$gte", int64_t( 0 ) ), kvp( "$lte", int64_t( 20 ) ) ) ) ),
+                             make_document( kvp( "account_action_seq", 1 ) )} );
+
+        bool indexed = true;
+        for( const auto& q : shapes ) {
+          if( index_thread_stop ) break;
+          try {
+            auto plan = db.run_command( make_document(
+                  kvp( "explain", make_document( kvp( "find", q.col ), kvp( "filter", q.filter.view() ), kvp( "sort", q.sort.view() ) ) ),
+                  kvp( "verbosity", "queryPlanner" ) ) );
+            auto winning = plan.view()["queryPlanner"]["winningPlan"];
+            if( winning && winning.type() == type::k_document && has_collscan( winning.get_document().value ) ) {
+              wlog( "${q} queries on ${c} are answered by a collection scan, filter: ${f}",
+                    ("q", q.what)("c", q.col)("f", bsoncxx::to_json( q.filter.view() )) );
+              indexed = false;
+            }
+          } catch( mongocxx::exception& e ) {
+            wlog( "Unable to explain ${q} queries on ${c}: ${e}", ("q", q.what)("c", q.col)("e", e.what()) );
+          }
+        }
+        if( indexed ) ilog( "History query plans use indices" );
+        return indexed;
+    }
+
+    /**
+     *  Seed the key and control indices of a state database that has none. Runs right after they are
+     *  added in plugin_initialize: their undo stack is still empty, so the objects are not recorded
+     *  in the session of a reversible block that could be undone by a fork.
+     */
+    void mongo_history_plugin_impl::bootstrap_key_indices() {
+        auto& db = const_cast<chainbase::database&>( chain_plug->chain().db() );
+        if( !db.get_index<public_key_history_index>().indices().empty() ||
+            !db.get_index<account_control_history_index>().indices().empty() )
+          return;
+
+        ilog( "Loading key and account control history" );
+        uint64_t keys = 0;
+        backend->for_each_pub_key( [&]( const bsoncxx::document::view& doc ) {
+          db.create<public_key_history_object>( [&]( public_key_history_object& obj ) {
+            obj.public_key = public_key_type( doc["public_key"].get_utf8().value.to_string() );
+            obj.name = compact_schema::to_name( doc["account"] );
+            obj.permission = compact_schema::to_name( doc["permission"] );
+          });
+          ++keys;
+          return true;
+        });
+        uint64_t controls = 0;
+        backend->for_each_account_control( [&]( const bsoncxx::document::view& doc ) {
+          db.create<account_control_history_object>( [&]( account_control_history_object& obj ) {
+            obj.controlled_account = compact_schema::to_name( doc["controlled_account"] );
+            obj.controlled_permission = compact_schema::to_name( doc["controlled_permission"] );
+            obj.controlling_account = compact_schema::to_name( doc["controlling_account"] );
+          });
+          ++controls;
+          return true;
+        });
+        ilog( "Loaded ${k} public keys and ${c} account controls", ("k", keys)("c", controls) );
+    }
+
+    void mongo_history_plugin_impl::add_account_actions( mongocxx::collection& account_actions, const chain::transaction_trace& t,
+                                                         const chain::action_trace& at, std::vector<bsoncxx::document::value>& rows ) {
+        // an action is in the history of its receiver and of every authorizer, same as history_plugin
+        flat_set<account_name> accounts;
+        accounts.insert( at.receipt.receiver );
+        for( const auto& auth : at.act.authorization ) {
+          accounts.insert( auth.actor );
+        }
+
+        const auto block_time = compact_schema::to_date( t.block_time );
+        for( const auto& a : accounts ) {
+          bsoncxx::builder::basic::document row;
+          append_name( row, "account", a );
+          row.append( kvp( "account_action_seq", next_action_seq( account_actions, a ) ),
+                      kvp( "global_sequence", int64_t( at.receipt.global_sequence ) ),
+                      kvp( "block_num", int64_t( t.block_num ) ),
+                      kvp( "block_time", block_time ),
+                      kvp( "trx_id", t.id.str() ) );
+          rows.emplace_back( row.extract() );
+        }
+
+        for( const auto& iline : at.inline_traces ) {
+          add_account_actions( account_actions, t, iline, rows );
+        }
+    }
+
+    void mongo_history_plugin_impl::append_name( bsoncxx::builder::basic::document& doc, const char* key, const name& n )const {
+        if( compact_documents ) doc.append( kvp( key, types::b_int64{ int64_t( n.value ) } ) );
+        else doc.append( kvp( key, n.to_string() ) );
+    }
+
+    int64_t mongo_history_plugin_impl::next_action_seq( mongocxx::collection& account_actions, const account_name& n ) {
+        auto itr = next_account_action_seq.find( n );
+        if( itr == next_account_action_seq.end() ) {
+          // first action of the account since startup, continue from the stored sequence
+          itr = next_account_action_seq.emplace( n, stored_action_seq_end( account_actions, n ) ).first;
+        }
+        return itr->second++;
+    }
+
+    int64_t mongo_history_plugin_impl::stored_action_seq_end( mongocxx::collection& account_actions, const account_name& n )const {
+        mongocxx::options::find opts;
+        opts.sort( make_document( kvp( "account_action_seq", -1 )));
+        opts.projection( make_document( kvp( "account_action_seq", 1 )));
+        auto last = account_actions.find_one( make_document( kvp( "account", compact_schema::name_match( n, compact_documents ) )), opts );
+        return last ? last->view()["account_action_seq"].get_int64().value + 1 : 0;
+    }
+
+    namespace {
+      /// the smallest block id of a block number, block ids start with the big endian block number
+      block_id_type first_block_id( uint32_t block_num ) {
+        block_id_type id;
+        id._hash[0] = fc::endian_reverse_u32( block_num );
+        return id;
+      }
+
+      bool is_onblock( const chain::transaction_trace& t ) {
+        if( t.action_traces.empty() ) return false;
+        const auto& act = t.action_traces.front().act;
+        return act.account == chain::config::system_account_name && act.name == N(onblock);
+      }
+    }
+
+    void mongo_history_plugin_impl::on_accepted_block( const chain::block_state_ptr& bs ) {
+        // a new head, including a fork switch, invalidates every reversible cache entry
+        head_block_num = bs->block_num;
+        if( bs->block_num % 1200 == 0 ) log_cache_stats();
+        if( !ingest_queue ) return;
+        throttle_ingest();
+
+        // keep the last trace of every transaction in the block, speculative attempts are discarded
+        flat_set<transaction_id_type> in_block;
+        for( const auto& receipt : bs->block->transactions ) {
+          in_block.insert( receipt.trx.contains<packed_transaction>() ? receipt.trx.get<packed_transaction>().id()
+                                                                      : receipt.trx.get<transaction_id_type>() );
+        }
+        staged_block sb{ bs->id, bs->block_num, bs->block, {} };
+        flat_set<transaction_id_type> seen;
+        for( auto itr = pending_traces.rbegin(); itr != pending_traces.rend(); ++itr ) {
+          const auto& t = *itr;
+          if( t->block_num != bs->block_num || !(in_block.count( t->id ) || is_onblock( *t )) ) continue;
+          if( seen.insert( t->id ).second ) sb.traces.emplace_back( t );
+        }
+        std::reverse( sb.traces.begin(), sb.traces.end() );
+        pending_traces.clear();
+        if( ingest ) {
+          for( const auto& receipt : bs->block->transactions ) {
+            if( receipt.trx.contains<packed_transaction>() ) {
+              auto mtrx = std::make_shared<transaction_metadata>( receipt.trx.get<packed_transaction>() );
+              mtrx->accepted = true;
+              sb.trxs.emplace_back( std::move( mtrx ) );
+            } else {
+              auto itr = pending_scheduled.find( receipt.trx.get<transaction_id_type>() );
+              if( itr != pending_scheduled.end() ) sb.trxs.emplace_back( itr->second );
+            }
+          }
+          pending_scheduled.clear();
+        }
+
+        if( !irreversible_only ) {
+          write_block( sb );
+          return;
+        }
+        std::lock_guard<std::mutex> g( staging_mtx );
+        // a block at or below the staged head replaces the old branch from that height
+        staged_blocks.erase( staged_blocks.lower_bound( first_block_id( bs->block_num ) ), staged_blocks.end() );
+        staged_blocks.emplace( bs->id, std::move( sb ) );
+    }
+
+    void mongo_history_plugin_impl::on_irreversible_block( const chain::block_state_ptr& bs ) {
+        lib_block_num = bs->block_num;
+        if( irreversible_only )
+          write_staged_through( bs->block_num );
+        else if( ingest_queue && ingest )
+          enqueue( ingest_entry{ {}, {}, 0, 0, bs->block_num } );
+    }
+
+    void mongo_history_plugin_impl::write_staged_through( uint32_t block_num ) {
+        std::vector<staged_block> ready;
+        {
+          std::lock_guard<std::mutex> g( staging_mtx );
+          auto end = block_num == std::numeric_limits<uint32_t>::max() ? staged_blocks.end()
+                                                                       : staged_blocks.lower_bound( first_block_id( block_num + 1 ) );
+          for( auto itr = staged_blocks.begin(); itr != end; ++itr ) {
+            ready.emplace_back( std::move( itr->second ) );
+          }
+          staged_blocks.erase( staged_blocks.begin(), end );
+        }
+
+        for( auto& sb : ready ) {
+          write_block( sb );
+        }
+    }
+
+    void mongo_history_plugin_impl::write_block( staged_block& sb ) {
+        if( sb.block_num <= last_block_written ) {
+          // irreversible history is never forked out, the block is replayed history written before
+          if( irreversible_only ) return;
+          // the branch written so far is replaced from this height, MongoDB has no undo
+          enqueue( ingest_entry{ {}, {}, sb.block_num } );
+        }
+        last_block_written = sb.block_num;
+        for( auto& trx : sb.trxs ) {
+          enqueue( ingest_entry{ {}, std::move( trx ), 0, sb.block_num } );
+        }
+        for( auto& t : sb.traces ) {
+          enqueue( ingest_entry{ std::move( t ), {} } );
+        }
+        enqueue( ingest_entry{ {}, {}, 0, sb.block_num } );
+    }
+
+    void mongo_history_plugin_impl::save_staged_blocks() {
+        std::lock_guard<std::mutex> g( staging_mtx );
+        if( staged_blocks.empty() ) return;
+        fc::variants blocks;
+        for( const auto& b : staged_blocks ) {
+          const auto& sb = b.second;
+          fc::variants traces;
+          for( const auto& t : sb.traces ) {
+            traces.emplace_back( *t );
+          }
+          fc::variants trxs;
+          for( const auto& trx : sb.trxs ) {
+            trxs.emplace_back( fc::mutable_variant_object( "trx", trx->packed_trx )( "accepted", trx->accepted )
+                                                         ( "implicit", trx->implicit )( "scheduled", trx->scheduled ) );
+          }
+          blocks.emplace_back( fc::mutable_variant_object( "id", sb.id )( "block_num", sb.block_num )( "block", *sb.block )
+                                                         ( "traces", std::move( traces ) )( "trxs", std::move( trxs ) ) );
+        }
+        boost::filesystem::create_directories( staged_blocks_file.parent_path() );
+        fc::json::save_to_file( fc::variant( std::move( blocks ) ), staged_blocks_file, false );
+        ilog( "Saved the history of ${n} reversible blocks to ${f}", ("n", staged_blocks.size())("f", staged_blocks_file.string()) );
+    }
+
+    void mongo_history_plugin_impl::load_staged_blocks() {
+        if( !boost::filesystem::exists( staged_blocks_file ) ) return;
+        const auto& chain = chain_plug->chain();
+        size_t loaded = 0;
+        std::lock_guard<std::mutex> g( staging_mtx );
+        for( const auto& v : fc::json::from_file( staged_blocks_file ).get_array() ) {
+          const auto& o = v.get_object();
+          staged_block sb;
+          sb.id = o["id"].as<block_id_type>();
+          sb.block_num = o["block_num"].as<uint32_t>();
+          // blocks that became irreversible while the plugin was not loaded, or are on no branch, are dropped
+          if( sb.block_num <= last_block_written || !chain.fetch_block_state_by_id( sb.id ) ) continue;
+          sb.block = std::make_shared<signed_block>( o["block"].as<signed_block>() );
+          for( const auto& t : o["traces"].get_array() ) {
+            sb.traces.emplace_back( std::make_shared<transaction_trace>( t.as<transaction_trace>() ) );
+          }
+          for( const auto& t : o["trxs"].get_array() ) {
+            const auto& trx = t.get_object();
+            auto mtrx = std::make_shared<transaction_metadata>( trx["trx"].as<packed_transaction>() );
+            mtrx->accepted = trx["accepted"].as_bool();
+            mtrx->implicit = trx["implicit"].as_bool();
+            mtrx->scheduled = trx["scheduled"].as_bool();
+            sb.trxs.emplace_back( std::move( mtrx ) );
+          }
+          staged_blocks.emplace( sb.id, std::move( sb ) );
+          ++loaded;
+        }
+        // a crash from here on loses them like any other staged block instead of loading stale ones
+        boost::filesystem::remove( staged_blocks_file );
+        ilog( "Loaded the history of ${n} reversible blocks from ${f}", ("n", loaded)("f", staged_blocks_file.string()) );
+    }
+
+    fc::optional<mongo_history_apis::read_only::get_transaction_result>
+    mongo_history_plugin_impl::find_staged_transaction( const string& id )const {
+        std::lock_guard<std::mutex> g( staging_mtx );
+        for( auto b = staged_blocks.rbegin(); b != staged_blocks.rend(); ++b ) {
+          const auto& sb = b->second;
+          for( const auto& t : sb.traces ) {
+            if( t->id.str().compare( 0, id.size(), id ) != 0 ) continue;
+
+            mongo_history_apis::read_only::get_transaction_result result;
+            result.id = t->id;
+            result.block_num = sb.block_num;
+            result.block_time = sb.block->timestamp;
+            result.last_irreversible_block = lib_block_num;
+            fc::mutable_variant_object trx( "receipt", t->receipt );
+            for( const auto& receipt : sb.block->transactions ) {
+              if( receipt.trx.contains<packed_transaction>() && receipt.trx.get<packed_transaction>().id() == t->id ) {
+                trx( "trx", receipt.trx.get<packed_transaction>().get_signed_transaction() );
+                break;
+              }
+            }
+            result.trx = std::move( trx );
+            for( const auto& atrace : t->action_traces ) {
+              result.traces.emplace_back( atrace );
+            }
+            return result;
+          }
+        }
+        return {};
+    }
+
+    void mongo_history_plugin_impl::add_staged_actions( const account_name& n,
+                                                        std::vector<mongo_history_apis::read_only::ordered_action_result>& out )const {
+        std::function<void(const staged_block&, const chain::action_trace&)> visit =
+              [&]( const staged_block& sb, const chain::action_trace& at ) {
+          bool involved = at.receipt.receiver == n;
+          for( const auto& auth : at.act.authorization ) {
+            involved = involved || auth.actor == n;
+          }
+          if( involved ) {
+            out.emplace_back( mongo_history_apis::read_only::ordered_action_result{
+                  at.receipt.global_sequence, int32_t( at.receipt.global_sequence ), sb.block_num, sb.block->timestamp, fc::variant( at ) } );
+          }
+          for( const auto& iline : at.inline_traces ) {
+            visit( sb, iline );
+          }
+        };
+
+        std::lock_guard<std::mutex> g( staging_mtx );
+        for( const auto& b : staged_blocks ) {
+          for( const auto& t : b.second.traces ) {
+            for( const auto& atrace : t->action_traces ) {
+              visit( b.second, atrace );
+            }
+          }
+        }
+    }
+
+    void mongo_history_plugin_impl::log_cache_stats()const {
+        if( trx_cache ) {
+          auto st = trx_cache->get_stats();
+          ilog( "transaction cache: ${e} entries, ${b} bytes, ${h} hits, ${m} misses, ${v} evictions, ${x} expirations",
+                ("e", st.entries)("b", st.bytes)("h", st.hits)("m", st.misses)("v", st.evictions)("x", st.expirations) );
+        }
+        if( actions_cache ) {
+          auto st = actions_cache->get_stats();
+          ilog( "actions cache: ${e} entries, ${b} bytes, ${h} hits, ${m} misses, ${v} evictions, ${x} expirations",
+                ("e", st.entries)("b", st.bytes)("h", st.hits)("m", st.misses)("v", st.evictions)("x", st.expirations) );
+        }
+        auto trx_st = trx_flights.get_stats();
+        auto actions_st = actions_flights.get_stats();
+        ilog( "coalesced requests: get_transaction ${tc} of ${tt}, get_actions ${ac} of ${at}",
+              ("tc", trx_st.coalesced)("tt", trx_st.executed + trx_st.coalesced)
+              ("ac", actions_st.coalesced)("at", actions_st.executed + actions_st.coalesced) );
+    }
 
     mongo_history_plugin::mongo_history_plugin()
     :my(std::make_shared<mongo_history_plugin_impl>()) {
@@ -74,51 +1465,823 @@ namespace eosio {
 
     void mongo_history_plugin::set_program_options(options_description& cli, options_description& cfg) {
         cfg.add_options()
+         ("history-backend", bpo::value<std::string>()->default_value("mongodb"),
+          "Where history is kept and read from:\n"
+          "  \"mongodb\" - the database of history-mongodb-uri\n"
+          "  \"store\" - memory mapped files in history-store-dir, written from the chain like history-mongodb-ingest\n"
+          "  \"memory\" - synthetic history generated at startup, to measure the read path without a mongod")
+         ("history-store-dir", bpo::value<std::string>()->default_value("history-store"),
+          "Directory of the history store, relative paths are relative to the data directory")
+         ("history-synthetic-transactions", bpo::value<uint32_t>()->default_value(100000),
+          "Number of token transfers generated for history-backend = memory")
+         ("history-synthetic-accounts", bpo::value<uint32_t>()->default_value(10000),
+          "Number of accounts the synthetic transfers are spread over")
+         ("history-synthetic-skew", bpo::value<double>()->default_value(1.0),
+          "Zipf exponent of how synthetic transfers are spread over accounts, 0 is uniform")
+         ("history-synthetic-seed", bpo::value<uint64_t>()->default_value(1),
+          "Seed of the synthetic history, the same options always generate the same history")
          ("history-mongodb-uri,m", bpo::value<std::string>(),
           "MongoDB URI connection string, see: https://docs.mongodb.com/master/reference/connection-string/."
               " If not specified then plugin is disabled. Default database 'EOS' is used if not specified in URI."
               " Example: mongodb://127.0.0.1:27017/EOS")
-        ; 
+         ("history-mongodb-store-account-actions", bpo::bool_switch()->default_value(false),
+          "Maintain the account_actions collection from applied transactions and answer get_actions from it")
+         ("history-mongodb-ingest", bpo::bool_switch()->default_value(false),
+          "Write transactions, transaction_traces, pub_keys and account_controls from the chain instead of relying on mongo_db_plugin")
+         ("history-mongodb-irreversible-only", bpo::bool_switch()->default_value(false),
+          "Hold the history of reversible blocks in memory and write it once the block is irreversible, forked out blocks are never written")
+         ("history-mongodb-schema", bpo::value<std::string>()->default_value("string"),
+          "Schema of the documents this plugin writes, reads understand both:\n"
+          "  \"string\" - names and times as strings, like mongo_db_plugin\n"
+          "  \"compact\" - names as their 64 bit value, sequences as int64 and block_time as a date")
+         ("history-mongodb-queue-size", bpo::value<uint32_t>()->default_value(4096),
+          "Capacity of the queue between block application and the MongoDB writer thread")
+         ("history-mongodb-batch-size", bpo::value<uint32_t>()->default_value(500),
+          "Maximum number of queued entries written to MongoDB in one batch")
+         ("history-mongodb-flush-interval-ms", bpo::value<uint32_t>()->default_value(250),
+          "Milliseconds before a partial batch is written to MongoDB")
+         ("history-mongodb-actions-query", bpo::value<std::string>()->default_value("filter"),
+          "How get_actions selects traces from transaction_traces when account_actions is not stored:\n"
+          "  \"filter\" - fetch matching transactions and filter their traces in the plugin\n"
+          "  \"aggregate\" - unwind and match traces in an aggregation pipeline so only matching traces are sent,"
+          " actions matching only below the first inline level are not returned")
+         ("history-mongodb-query-parallelism", bpo::value<uint32_t>()->default_value(1),
+          "Number of _id ranges a transaction_traces scan for get_actions is split into and run concurrently, 1 scans sequentially")
+         ("history-mongodb-query-time-ms", bpo::value<uint32_t>()->default_value(100),
+          "Milliseconds a get_actions request may take, passed to MongoDB as maxTimeMS. A request that runs out of time returns"
+          " the actions found so far with time_limit_exceeded_error and a next_cursor to continue from")
+         ("history-mongodb-create-indices", bpo::value<bool>()->default_value(true),
+          "Create the indices used by the history API at startup, in the background")
+         ("history-mongodb-index-check", bpo::value<std::string>()->default_value("warn"),
+          "Check at startup that history queries are answered from indices:\n"
+          "  \"off\" - no check\n"
+          "  \"warn\" - log queries that would scan a whole collection\n"
+          "  \"require\" - shut down if a query would scan a whole collection")
+         ("history-trace-sample-rate", bpo::value<uint32_t>()->default_value(0),
+          "Log the MongoDB, decode and filter time of every Nth history request, 0 disables")
+         ("history-account-filter-size", bpo::value<uint64_t>()->default_value(0),
+          "Accounts with history the filter answering get_actions of accounts without history is sized for, 0 disables it. "
+          "Its accounts are loaded with a pass over the history at every startup")
+         ("history-cache-size-mb", bpo::value<uint32_t>()->default_value(256),
+          "Memory for cached get_transaction and first page get_actions results, 0 disables the cache")
+         ("history-cache-reversible-ttl-ms", bpo::value<uint32_t>()->default_value(500),
+          "Milliseconds a result involving reversible blocks stays cached, it is also dropped when the head block changes")
+         ("history-mongodb-pool-min-size", bpo::value<uint32_t>(),
+          "Minimum number of pooled MongoDB connections kept open, overrides minPoolSize in the URI")
+         ("history-mongodb-pool-max-size", bpo::value<uint32_t>()->default_value(100),
+          "Maximum number of pooled MongoDB connections shared by the read_only API, overrides maxPoolSize in the URI")
+         ("history-mongodb-wait-queue-timeout-ms", bpo::value<uint32_t>()->default_value(1000),
+          "Milliseconds a request waits for a pooled MongoDB connection before failing, 0 waits indefinitely")
+        ;
+    }
+
+    namespace {
+      /// options given on the command line take precedence over the same option in the URI
+      void append_uri_option( std::string& uri_str, const std::string& key, uint32_t value ) {
+        auto query = uri_str.find( '?' );
+        if( query == std::string::npos ) {
+          // a path separator is required before the options
+          auto hosts = uri_str.find( "://" );
+          if( uri_str.find( '/', hosts == std::string::npos ? 0 : hosts + 3 ) == std::string::npos )
+            uri_str += '/';
+          uri_str += '?';
+        } else if( query + 1 != uri_str.size() && uri_str.back() != '&' ) {
+          uri_str += '&';
+        }
+        uri_str += key + "=" + std::to_string( value );
+      }
     }
 
     void mongo_history_plugin::plugin_initialize(const variables_map& options) {
         ilog( "Welcome to the THUNDERDOME!!!!!" );
         try {
-          if( options.count( "history-mongodb-uri" )) {
+          const auto& schema = options.at( "history-mongodb-schema" ).as<std::string>();
+          EOS_ASSERT( schema == "string" || schema == "compact", chain::plugin_config_exception,
+                      "Unknown history-mongodb-schema ${s}, expected string or compact", ("s", schema) );
+          my->compact_documents = schema == "compact";
+          const uint64_t cache_bytes = uint64_t( options.at( "history-cache-size-mb" ).as<uint32_t>() ) * 1024 * 1024;
+          if( cache_bytes > 0 ) {
+            // transactions are looked up far more often than pages of actions
+            my->trx_cache = std::make_unique<mongo_history_plugin_impl::transaction_cache>( cache_bytes / 4 * 3 );
+            my->actions_cache = std::make_unique<mongo_history_plugin_impl::actions_cache_type>( cache_bytes / 4 );
+            my->reversible_cache_ttl = fc::milliseconds( options.at( "history-cache-reversible-ttl-ms" ).as<uint32_t>() );
+          }
+          my->query_time = fc::milliseconds( options.at( "history-mongodb-query-time-ms" ).as<uint32_t>() );
+          EOS_ASSERT( my->query_time.count() > 0, chain::plugin_config_exception,
+                      "history-mongodb-query-time-ms must be greater than 0" );
+
+          const auto& backend = options.at( "history-backend" ).as<std::string>();
+          EOS_ASSERT( backend == "mongodb" || backend == "store" || backend == "memory", chain::plugin_config_exception,
+                      "Unknown history-backend ${b}, expected mongodb, store or memory", ("b", backend) );
+          if( backend == "memory" ) {
+            synthetic_history_config synthetic;
+            synthetic.transactions = options.at( "history-synthetic-transactions" ).as<uint32_t>();
+            synthetic.accounts = options.at( "history-synthetic-accounts" ).as<uint32_t>();
+            synthetic.skew = options.at( "history-synthetic-skew" ).as<double>();
+            synthetic.seed = options.at( "history-synthetic-seed" ).as<uint64_t>();
+            EOS_ASSERT( synthetic.accounts > 0 && synthetic.skew >= 0, chain::plugin_config_exception,
+                        "history-synthetic-accounts must be greater than 0 and history-synthetic-skew not negative" );
+            my->load_synthetic_history( synthetic );
+            my->synthetic = true;
+          } else if( backend == "store" ) {
+            auto dir = boost::filesystem::path( options.at( "history-store-dir" ).as<std::string>() );
+            if( dir.is_relative() )
+              dir = app().data_dir() / dir;
+            ilog( "opening history store in ${d}", ("d", dir.string()) );
+            auto store = std::make_unique<mapped_history_store>( dir );
+            ilog( "history store holds ${n} transaction traces", ("n", store->trace_count()) );
+            my->store = store.get();
+            // blocks replayed by the chain before plugin_startup are skipped up to the last commit
+            my->last_block_written = store->last_block();
+            my->backend = std::move( store );
+            // filled from the chain, there is no mongo_db_plugin to rely on
+            my->ingest = true;
+          } else if( options.count( "history-mongodb-uri" )) {
             std::string uri_str = options.at( "history-mongodb-uri" ).as<std::string>();
             ilog( "connecting to ${u}", ("u", uri_str));
+
+            my->pool_max_size = options.at( "history-mongodb-pool-max-size" ).as<uint32_t>();
+            my->wait_queue_timeout = fc::milliseconds( options.at( "history-mongodb-wait-queue-timeout-ms" ).as<uint32_t>() );
+            EOS_ASSERT( my->pool_max_size > 0, chain::plugin_config_exception,
+                        "history-mongodb-pool-max-size must be greater than 0" );
+            append_uri_option( uri_str, "maxPoolSize", my->pool_max_size );
+            if( options.count( "history-mongodb-pool-min-size" )) {
+              auto min_size = options.at( "history-mongodb-pool-min-size" ).as<uint32_t>();
+              EOS_ASSERT( min_size <= my->pool_max_size, chain::plugin_config_exception,
+                          "history-mongodb-pool-min-size must not exceed history-mongodb-pool-max-size" );
+              append_uri_option( uri_str, "minPoolSize", min_size );
+            }
+
+            // shared with mongo_db_plugin when both are loaded, only one instance may exist per process
+            mongocxx::instance::current();
             mongocxx::uri uri = mongocxx::uri{uri_str};
             my->db_name = uri.database();
             if( my->db_name.empty())
-            my->mongo_client = {uri};
                 my->db_name = "EOS";
+            my->mongo_pool = std::make_unique<mongocxx::pool>( uri );
+            my->backend = std::make_unique<mongo_backend>( *my );
+            my->store_account_actions = options.at( "history-mongodb-store-account-actions" ).as<bool>();
+            my->ingest = options.at( "history-mongodb-ingest" ).as<bool>();
+            my->query_parallelism = std::max<uint32_t>( 1, options.at( "history-mongodb-query-parallelism" ).as<uint32_t>() );
+            if( my->query_parallelism > 1 )
+              my->query_pool = std::make_unique<boost::asio::thread_pool>( my->query_parallelism );
+            my->create_indices = options.at( "history-mongodb-create-indices" ).as<bool>();
+            const auto& index_check = options.at( "history-mongodb-index-check" ).as<std::string>();
+            if( index_check == "off" ) {
+              my->index_check = index_check_mode::off;
+            } else if( index_check == "require" ) {
+              my->index_check = index_check_mode::require;
+            } else {
+              EOS_ASSERT( index_check == "warn", chain::plugin_config_exception,
+                          "Unknown history-mongodb-index-check ${c}, expected off, warn or require", ("c", index_check) );
+            }
+            const auto& actions_query = options.at( "history-mongodb-actions-query" ).as<std::string>();
+            if( actions_query == "aggregate" ) {
+              my->actions_query = actions_query_mode::aggregate;
+            } else {
+              EOS_ASSERT( actions_query == "filter", chain::plugin_config_exception,
+                          "Unknown history-mongodb-actions-query ${q}, expected filter or aggregate", ("q", actions_query) );
+            }
           } else {
             wlog( "eosio::mongo_history_plugin configured, but no --history-mongodb-uri specified." );
             wlog( "mongo_history_plugin disabled." );
           }
+          if( my->ingest || my->store_account_actions ) {
+            const auto queue_size = options.at( "history-mongodb-queue-size" ).as<uint32_t>();
+            my->batch_size = options.at( "history-mongodb-batch-size" ).as<uint32_t>();
+            my->flush_interval = fc::milliseconds( options.at( "history-mongodb-flush-interval-ms" ).as<uint32_t>() );
+            EOS_ASSERT( queue_size > 0 && my->batch_size > 0, chain::plugin_config_exception,
+                        "history-mongodb-queue-size and history-mongodb-batch-size must be greater than 0" );
+            my->ingest_queue = std::make_unique<boost::lockfree::spsc_queue<ingest_entry>>( queue_size );
+            my->max_overflow = size_t( queue_size ) * 16;
+            // the store is append only, history of blocks that may still fork out is never written to it
+            my->irreversible_only = my->store || options.at( "history-mongodb-irreversible-only" ).as<bool>();
+            my->staged_blocks_file = app().data_dir() / "mongo_history" / "staged_blocks.json";
+          }
+          my->trace_sample_rate = options.at( "history-trace-sample-rate" ).as<uint32_t>();
+          const auto filter_size = options.at( "history-account-filter-size" ).as<uint64_t>();
+          if( my->backend && filter_size )
+            my->account_filter = std::make_unique<bloom_filter>( filter_size, 0.01 );
           // init chain plugin
           my->chain_plug = app().find_plugin<chain_plugin>();
           EOS_ASSERT( my->chain_plug, chain::missing_chain_plugin_exception, ""  );
+          auto& chain = my->chain_plug->chain();
+          my->accepted_block_connection.emplace(
+                chain.accepted_block.connect( [&]( const chain::block_state_ptr& bs ) {
+                  my->on_accepted_block( bs );
+                } ));
+          my->irreversible_block_connection.emplace(
+                chain.irreversible_block.connect( [&]( const chain::block_state_ptr& bs ) {
+                  my->on_irreversible_block( bs );
+                } ));
+          chainbase::database& db = const_cast<chainbase::database&>( chain.db() ); // Override read-only access to state DB (highly unrecommended practice!)
+          db.add_index<public_key_history_index>();
+          db.add_index<account_control_history_index>();
+          // before chain startup opens undo sessions: objects created now are in no session a fork
+          // of a reversible block could roll back
+          if( my->backend && !my->synthetic )
+            my->bootstrap_key_indices();
+          my->applied_transaction_connection.emplace(
+                chain.applied_transaction.connect( [&]( const transaction_trace_ptr& p ) {
+                  my->on_applied_transaction( p );
+                } ));
+          if( my->ingest ) {
+            my->accepted_transaction_connection.emplace(
+                  chain.accepted_transaction.connect( [&]( const transaction_metadata_ptr& t ) {
+                    my->on_accepted_transaction( t );
+                  } ));
+          }
+          // running before chain_plugin startup so a replay is ingested as well
+          if( my->ingest_queue )
+            my->start_writer();
         }FC_LOG_AND_RETHROW()
     }
 
     void mongo_history_plugin::plugin_startup() {
+        auto& chain = my->chain_plug->chain();
+        my->head_block_num = chain.head_block_num();
+        my->lib_block_num = chain.last_irreversible_block_num();
+        // history up to the head was written before a restart, in irreversible only mode up to the
+        // last irreversible block and the reversible rest saved at shutdown is staged again
+        my->last_block_written = std::max( my->last_block_written,
+                                           my->irreversible_only ? my->lib_block_num.load() : my->head_block_num.load() );
+        if( my->store && my->store->last_block() < my->lib_block_num )
+          wlog( "history store ends at block ${s}, before the last irreversible block ${b}, replay the chain to fill the gap",
+                ("s", my->store->last_block())("b", my->lib_block_num.load()) );
+        if( my->irreversible_only )
+          my->load_staged_blocks();
+        if( my->account_filter && !my->mongo_pool )
+          my->load_account_filter();
+        if( my->mongo_pool && (my->create_indices || my->index_check != index_check_mode::off || my->account_filter) ) {
+          my->index_thread = std::thread( [my = my]() {
+            my->provision_indices();
+            // account_actions is grouped along its account index, created first
+            if( my->account_filter && !my->index_thread_stop ) my->load_account_filter();
+          } );
+        }
     }
 
     void mongo_history_plugin::plugin_shutdown() {
-        //my->applied_transaction_connection.reset();
+        my->applied_transaction_connection.reset();
+        my->accepted_transaction_connection.reset();
+        my->accepted_block_connection.reset();
+        my->irreversible_block_connection.reset();
+        // reversible blocks are not applied again after a restart, keep their history. Held back
+        // blocks may still fork out, they are saved and staged again at startup instead of written
+        if( my->irreversible_only )
+          my->save_staged_blocks();
+        else if( my->ingest_queue && my->ingest )
+          my->enqueue( ingest_entry{ {}, {}, 0, 0, std::numeric_limits<uint32_t>::max() } );
+        my->stop_writer();
+        // an index build already sent keeps running on the server
+        my->index_thread_stop = true;
+        if( my->index_thread.joinable() ) my->index_thread.join();
+        if( my->query_pool ) my->query_pool->join();
+        my->log_cache_stats();
     }
 
     namespace mongo_history_apis {
 
-        read_only::get_actions_result read_only::get_actions( const read_only::get_actions_params& params )const {
-          
+      namespace {
+        /// numbers are stored as int32, int64 or string depending on their size when written through json
+        uint64_t to_uint64( const bsoncxx::document::element& ele ) {
+          switch( ele.type() ) {
+            case type::k_int32:  return uint64_t( ele.get_int32().value );
+            case type::k_int64:  return uint64_t( ele.get_int64().value );
+            case type::k_double: return uint64_t( ele.get_double().value );
+            case type::k_utf8:   return std::stoull( ele.get_utf8().value.to_string() );
+            default:
+              EOS_THROW( chain::plugin_exception, "Unexpected BSON type ${t} for a numeric field", ("t", bsoncxx::to_string( ele.type() )) );
+          }
+        }
+
+        /**
+         *  One read_only request: its time budget, checked between documents and passed to MongoDB as
+         *  max_time, whether it is traced and its metrics.
+         */
+        struct query_context {
+          /// time_limit_ms may only lower history-mongodb-query-time-ms
+          query_context( const mongo_history_plugin_impl& history, const fc::optional<uint32_t>& time_limit_ms )
+          :start( fc::time_point::now() ), traced( history.sample_trace() ) {
+            fc::microseconds time_limit = history.query_time;
+            if( time_limit_ms )
+              time_limit = std::min( time_limit, fc::milliseconds( *time_limit_ms ) );
+            end = start + time_limit;
+          }
+
+          const fc::time_point     start;
+          fc::time_point           end;
+          const bool               traced;
+          mutable request_metrics  metrics;
+
+          bool expired()const { return fc::time_point::now() >= end; }
+
+          /// a max_time of 0 disables the server side limit, an expired deadline still sends 1ms
+          std::chrono::milliseconds remaining()const {
+            return std::chrono::milliseconds( std::max<int64_t>( 1, (end - fc::time_point::now()).count() / 1000 ) );
+          }
+        };
+
+        /// attributes the time since the previous lap to a stage of request_metrics
+        class stage_clock {
+          public:
+            void lap( std::atomic<int64_t>& stage ) {
+              const auto now = fc::time_point::now();
+              stage += (now - last).count();
+              last = now;
+            }
+
+          private:
+            fc::time_point last = fc::time_point::now();
+        };
+
+        /// counts a document received from MongoDB
+        void add_scanned( const query_context& ctx, const bsoncxx::document::view& doc ) {
+          ++ctx.metrics.docs_scanned;
+          ctx.metrics.bytes_received += doc.length();
+        }
+
+        /// records a request into its endpoint_metrics when it goes out of scope, sampled requests are logged
+        struct metrics_scope {
+          const char*            endpoint;
+          endpoint_metrics&      metrics;
+          const query_context&   ctx;
+          uint64_t               returned = 0;
+
+          ~metrics_scope() {
+            metrics.record( ctx.start, ctx.metrics, returned );
+            if( ctx.traced ) {
+              ilog( "${e}: ${r} returned, ${d} documents, ${b} bytes, mongo ${f}us, decode ${c}us, filter ${x}us, total ${t}us",
+                    ("e", endpoint)("r", returned)("d", ctx.metrics.docs_scanned.load())("b", ctx.metrics.bytes_received.load())
+                    ("f", ctx.metrics.fetch_us.load())("c", ctx.metrics.decode_us.load())("x", ctx.metrics.filter_us.load())
+                    ("t", (fc::time_point::now() - ctx.start).count()) );
+            }
+          }
+        };
+
+        /// the server aborted the operation because its max_time passed
+        bool max_time_expired( const mongocxx::operation_exception& e ) {
+          return e.code().value() == 50; // MaxTimeMSExpired
+        }
+
+        /// action traces are nested through inline_traces, find the one with the given global sequence
+        fc::optional<bsoncxx::document::view> find_action_trace( const bsoncxx::array::view& traces, uint64_t global_sequence ) {
+          for( auto trace : traces ) {
+            auto trace_view = trace.get_document().view();
+            auto seq = trace_view["receipt"]["global_sequence"];
+            if( seq && to_uint64( seq ) == global_sequence )
+              return trace_view;
+            auto inlines = trace_view["inline_traces"];
+            if( inlines && inlines.type() == type::k_array ) {
+              auto found = find_action_trace( inlines.get_array().value, global_sequence );
+              if( found ) return found;
+            }
+          }
+          return {};
+        }
+
+        /// the plan a cursor continues, tokens of one are rejected by the others after a configuration change.
+        /// trace and aggregate cursors read alike but the plans match different actions, see actions_query_mode
+        enum class cursor_plan { seq, trace, aggregate };
+
+        const char* plan_name( cursor_plan p ) {
+          switch( p ) {
+            case cursor_plan::seq: return "seq";
+            case cursor_plan::trace: return "trace";
+            case cursor_plan::aggregate: return "aggregate";
+          }
+          return "";
+        }
+
+        /// continuation tokens are base64 encoded BSON documents, opaque to the caller
+        string encode_cursor( const bsoncxx::document::view& v ) {
+          return fc::base64_encode( v.data(), v.length() );
+        }
+
+        /// account_actions plan: continue past account_action_seq seq
+        string encode_seq_cursor( const string& account, int32_t direction, int64_t seq ) {
+          return encode_cursor( make_document( kvp( "p", plan_name( cursor_plan::seq ) ), kvp( "a", account ),
+                                               kvp( "d", direction ), kvp( "seq", seq ) ) );
+        }
+
+        /// transaction_traces plans: continue at the trace with _id id, after its first n matches
+        string encode_trace_cursor( const string& account, int32_t direction, const bsoncxx::types::value& id, int64_t n,
+                                    cursor_plan plan = cursor_plan::trace ) {
+          return encode_cursor( make_document( kvp( "p", plan_name( plan ) ), kvp( "a", account ),
+                                               kvp( "d", direction ), kvp( "id", id ), kvp( "n", n ) ) );
+        }
+
+        /// a token with every field the plan reads, in the type it reads it as
+        bsoncxx::document::value decode_cursor( const string& token, const account_name& n, cursor_plan plan ) {
+          string raw;
+          try {
+            raw = fc::base64_decode( token );
+          } catch( ... ) {
+            EOS_THROW( chain::plugin_exception, "Invalid get_actions cursor" );
+          }
+          auto view = bsoncxx::validate( reinterpret_cast<const uint8_t*>( raw.data() ), raw.size() );
+          EOS_ASSERT( view, chain::plugin_exception, "Invalid get_actions cursor" );
+          bsoncxx::document::value doc{ *view };
+          const auto v = doc.view();
+          auto p = v["p"];
+          EOS_ASSERT( p && p.type() == type::k_utf8 && p.get_utf8().value.to_string() == plan_name( plan ), chain::plugin_exception,
+                      "get_actions cursor was issued by a different query plan, request the first page again" );
+          auto acct = v["a"];
+          auto dir = v["d"];
+          EOS_ASSERT( acct && acct.type() == type::k_utf8 && acct.get_utf8().value.to_string() == n.to_string(),
+                      chain::plugin_exception, "get_actions cursor was issued for a different account" );
+          EOS_ASSERT( dir && dir.type() == type::k_int32 && std::abs( dir.get_int32().value ) == 1,
+                      chain::plugin_exception, "Invalid get_actions cursor" );
+          if( plan == cursor_plan::seq ) {
+            auto seq = v["seq"];
+            EOS_ASSERT( seq && seq.type() == type::k_int64, chain::plugin_exception, "Invalid get_actions cursor" );
+          } else {
+            // ObjectIds in MongoDB, int64 offsets or indices in the other backends
+            auto id = v["id"];
+            auto skip = v["n"];
+            EOS_ASSERT( id && (id.type() == type::k_oid || id.type() == type::k_int64), chain::plugin_exception,
+                        "Invalid get_actions cursor" );
+            EOS_ASSERT( skip && skip.type() == type::k_int64 && skip.get_int64().value >= 0, chain::plugin_exception,
+                        "Invalid get_actions cursor" );
+          }
+          return doc;
+        }
+
+        /// history_plugin pos/offset semantics as an inclusive account_action_seq range, pos -1 follows last_seq
+        std::pair<int32_t, int32_t> action_seq_range( int32_t pos, int32_t offset, const fc::optional<int64_t>& last_seq ) {
+          int32_t start = 0;
+          int32_t end = 0;
+          if( pos == -1 && last_seq ) pos = int32_t( *last_seq ) + 1;
+          if( pos == -1 ) pos = 0xfffffff;
+
+          if( offset > 0 ) {
+            start = pos;
+            end   = start + offset;
+          } else {
+            start = pos + offset;
+            if( start > pos ) start = 0;
+            end   = pos;
+          }
+          EOS_ASSERT( end >= start, chain::plugin_exception, "end position is earlier than start position" );
+          return {start, end};
+        }
+
+        /// transaction_traces referenced by account_actions rows, fetched in one query and keyed by id
+        std::map<string, bsoncxx::document::value> fetch_row_traces( const mongo_history_plugin_impl& history, mongocxx::database& db,
+                                                                     const std::vector<bsoncxx::document::value>& rows,
+                                                                     const query_context& ctx ) {
+          std::set<string> trx_ids;
+          for( const auto& row : rows ) {
+            trx_ids.insert( row.view()["trx_id"].get_utf8().value.to_string() );
+          }
+          bsoncxx::builder::basic::array ids;
+          for( const auto& id : trx_ids ) {
+            ids.append( id );
+          }
+          stage_clock clock;
+          mongocxx::options::find trace_opts;
+          trace_opts.projection( make_document( kvp( "id", 1 ), kvp( "schema", 1 ), kvp( "action_traces", 1 )));
+          trace_opts.max_time( ctx.remaining() );
+          auto trace_cursor = db[history.trans_traces_col].find( make_document( kvp( "id", make_document( kvp( "$in", ids ) ) ) ), trace_opts );
+          std::map<string, bsoncxx::document::value> traces;
+          for( auto&& doc : trace_cursor ) {
+            add_scanned( ctx, doc );
+            traces.emplace( doc["id"].get_utf8().value.to_string(), bsoncxx::document::value( doc ) );
+          }
+          clock.lap( ctx.metrics.fetch_us );
+          return traces;
+        }
+
+        /**
+         *  Convert the ascending account_actions rows of one page. Rows are converted in paging direction
+         *  so a page cut short by the deadline ends where its next_cursor continues.
+         */
+        void convert_rows( const std::vector<bsoncxx::document::view>& rows, int32_t direction,
+                           const std::map<string, bsoncxx::document::value>& traces, const string& account,
+                           const query_context& ctx, read_only::get_actions_result& result ) {
+          const size_t n = rows.size();
+          if( n == 0 ) return;
+          stage_clock clock;
+          size_t converted = 0;
+          while( converted < n ) {
+            auto row_view = rows[direction < 0 ? n - 1 - converted : converted];
+            ++converted;
+            auto itr = traces.find( row_view["trx_id"].get_utf8().value.to_string() );
+            if( itr != traces.end() ) {
+              auto ele = itr->second.view()["action_traces"];
+              if( ele && ele.type() == type::k_array ) {
+                uint64_t global_sequence = to_uint64( row_view["global_sequence"] );
+                auto trace_view = find_action_trace( ele.get_array().value, global_sequence );
+                if( trace_view ) {
+                  result.actions.emplace_back( read_only::ordered_action_result{
+                        global_sequence,
+                        int32_t( row_view["account_action_seq"].get_int64().value ),
+                        uint32_t( to_uint64( row_view["block_num"] ) ),
+                        compact_schema::to_block_time( row_view["block_time"] ),
+                        compact_schema::to_variant( *trace_view, compact_schema::is_compact( itr->second.view() ) )
+                  });
+                }
+              }
+            }
+            if( converted < n && ctx.expired() ) {
+              result.time_limit_exceeded_error = true;
+              break;
+            }
+          }
+          if( direction < 0 )
+            std::reverse( result.actions.begin(), result.actions.end() );
+          clock.lap( ctx.metrics.decode_us );
+
+          auto boundary_row = rows[direction < 0 ? n - converted : converted - 1];
+          result.next_cursor = encode_seq_cursor( account, direction, boundary_row["account_action_seq"].get_int64().value );
+        }
+
+        /**
+         *  Answer get_actions from the account_actions index. pos/offset have the same semantics as
+         *  history_plugin and resolve to one range scan, a cursor continues with a seek past the last
+         *  account_action_seq of the previous page.
+         */
+        read_only::get_actions_result get_indexed_actions( const mongo_history_plugin_impl& history,
+                                                           const read_only::get_actions_params& params,
+                                                           const query_context& ctx ) {
+          int32_t pos = params.pos ? *params.pos : -1;
+          int32_t offset = params.offset ? *params.offset : -20;
+          const string account = params.account_name.to_string();
+
+          auto client = history.acquire_client();
+          auto db = (*client)[history.db_name];
+          auto account_actions = db[history.account_actions_col];
+
+          read_only::get_actions_result result;
+          result.last_irreversible_block = history.chain_plug->chain().last_irreversible_block_num();
+
+          stage_clock clock;
+          int32_t direction = offset < 0 ? -1 : 1;
+          mongocxx::options::find opts;
+          bsoncxx::document::value query = make_document();
+          if( params.cursor ) {
+            auto resume = decode_cursor( *params.cursor, params.account_name, cursor_plan::seq );
+            direction = resume.view()["d"].get_int32().value;
+            const int64_t boundary = resume.view()["seq"].get_int64().value;
+            opts.sort( make_document( kvp( "account_action_seq", direction )));
+            opts.limit( std::max( std::abs( offset ), 1 ));
+            query = make_document( kvp( "account", compact_schema::name_match( params.account_name, history.compact_documents ) ),
+                                   kvp( "account_action_seq", make_document( kvp( direction > 0 ? "$gt" : "$lt", boundary ) ) ) );
+          } else {
+            fc::optional<int64_t> last_seq;
+            if( pos == -1 ) {
+              mongocxx::options::find last_opts;
+              last_opts.sort( make_document( kvp( "account_action_seq", -1 )));
+              last_opts.projection( make_document( kvp( "account_action_seq", 1 )));
+              last_opts.max_time( ctx.remaining() );
+              auto last = account_actions.find_one( make_document( kvp( "account", compact_schema::name_match( params.account_name, history.compact_documents ) )), last_opts );
+              if( last ) last_seq = last->view()["account_action_seq"].get_int64().value;
+            }
+            auto range = action_seq_range( pos, offset, last_seq );
+
+            opts.sort( make_document( kvp( "account_action_seq", 1 )));
+            query = make_document( kvp( "account", compact_schema::name_match( params.account_name, history.compact_documents ) ),
+                                   kvp( "account_action_seq", make_document( kvp( "$gte", int64_t( range.first ) ),
+                                                                             kvp( "$lte", int64_t( range.second ) ) ) ) );
+          }
+          opts.max_time( ctx.remaining() );
+          auto cursor = account_actions.find( query.view(), opts );
+
+          std::vector<bsoncxx::document::value> rows;
+          for( auto&& row : cursor ) {
+            add_scanned( ctx, row );
+            rows.emplace_back( row );
+          }
+          clock.lap( ctx.metrics.fetch_us );
+          if( rows.empty() ) return result;
+          // pages read backwards by a cursor are still returned in ascending order
+          if( params.cursor && direction < 0 )
+            std::reverse( rows.begin(), rows.end() );
+
+          const auto traces = fetch_row_traces( history, db, rows, ctx );
+          std::vector<bsoncxx::document::view> views;
+          views.reserve( rows.size() );
+          for( const auto& row : rows ) {
+            views.emplace_back( row.view() );
+          }
+          convert_rows( views, direction, traces, account, ctx, result );
+          return result;
+        }
+
+        /// a trace out of a transaction_traces document, compact if the document is
+        read_only::ordered_action_result to_ordered_action( const bsoncxx::document::view& trace_view, bool compact ) {
+          const uint64_t global_sequence = to_uint64( trace_view["receipt"]["global_sequence"] );
+          return read_only::ordered_action_result{
+                       global_sequence,
+                       int32_t( global_sequence ),
+                       uint32_t( to_uint64( trace_view["block_num"] ) ),
+                       compact_schema::to_block_time( trace_view["block_time"] ),
+                       compact_schema::to_variant( trace_view, compact )
+                       };
+        }
+
+        /// the smallest ObjectId generated at the given second
+        bsoncxx::oid oid_at( uint32_t seconds ) {
+          char bytes[12] = {};
+          bytes[0] = char( seconds >> 24 );
+          bytes[1] = char( seconds >> 16 );
+          bytes[2] = char( seconds >> 8 );
+          bytes[3] = char( seconds );
+          return bsoncxx::oid( bytes, sizeof( bytes ) );
+        }
+
+        /// matches found by one worker of a partitioned scan, in scan order
+        struct partition_scan {
+          bsoncxx::document::value                            range = make_document();
+          std::vector<read_only::ordered_action_result>       actions;
+          std::vector<std::pair<size_t, size_t>>              positions;  ///< per action: index into ids, match number in its document
+          std::vector<bsoncxx::document::value>               ids;        ///< {"id": _id} of each document with matches
+          fc::optional<bsoncxx::document::value>              stop;       ///< {"id": _id, "n": matches} of the last scanned document
+          bool                                                time_limit_exceeded = false;
+        };
+
+        /**
+         *  Scan transaction_traces for the first page of an account, or the page after a cursor, by
+         *  splitting the _id range into history.query_parallelism slices on their ObjectId timestamps.
+         *  Every slice is scanned on its own pooled connection, all checked out before the scans start:
+         *  only the first one is waited for, the request gets as many slices as clients are free, so
+         *  requests never wait for each other's clients. Since the slices are disjoint and
+         *  ordered, merging the per-slice results in slice order yields the sequential result. A slice
+         *  stops as soon as the slices before it settled the page. Returns false if the _ids are not
+         *  ObjectIds, the caller then scans sequentially.
+         */
+        bool get_partitioned_actions( const mongo_history_plugin_impl& history,
+                                      const account_name& name, int32_t sort, const bsoncxx::document::view& actions_query,
+                                      const fc::optional<bsoncxx::document::value>& resume, size_t resume_skip, size_t limit,
+                                      const query_context& ctx, read_only::get_actions_result& result ) {
+          bsoncxx::stdx::optional<bsoncxx::document::value> first;
+          bsoncxx::stdx::optional<bsoncxx::document::value> last;
+          std::vector<mongocxx::pool::entry> clients;   // one per slice, the first finds the bounds
+          clients.emplace_back( history.acquire_client() );
+          {
+            auto trans_trace = (*clients.front())[history.db_name][history.trans_traces_col];
+            mongocxx::options::find bound_opts;
+            bound_opts.projection( make_document( kvp( "_id", 1 )));
+            bound_opts.max_time( ctx.remaining() );
+            bound_opts.sort( make_document( kvp( "_id", 1 )));
+            first = trans_trace.find_one( make_document(), bound_opts );
+            bound_opts.sort( make_document( kvp( "_id", -1 )));
+            last = trans_trace.find_one( make_document(), bound_opts );
+          }
+          if( !first || !last ) return true;
+          if( first->view()["_id"].type() != type::k_oid || last->view()["_id"].type() != type::k_oid ) return false;
+
+          bsoncxx::oid lo = first->view()["_id"].get_oid().value;
+          bsoncxx::oid hi = last->view()["_id"].get_oid().value;
+          if( resume ) {
+            auto resume_id = resume->view()["id"];
+            if( resume_id.type() != type::k_oid ) return false;
+            (sort > 0 ? lo : hi) = resume_id.get_oid().value;
+          }
+          if( hi < lo ) return true;
+
+          // slice boundaries on whole seconds, ascending
+          const uint32_t lo_ts = uint32_t( lo.get_time_t() );
+          const uint32_t hi_ts = uint32_t( hi.get_time_t() );
+          const size_t wanted = std::max<size_t>( 1, std::min<size_t>( history.query_parallelism, hi_ts - lo_ts + 1 ) );
+          while( clients.size() < wanted ) {
+            auto client = history.try_acquire_client();
+            if( !client ) break;
+            clients.emplace_back( std::move( client ) );
+          }
+          const size_t n = clients.size();
+          std::vector<partition_scan> scans( n );
+          for( size_t i = 0; i < n; ++i ) {
+            bsoncxx::builder::basic::document range;
+            if( i == 0 ) range.append( kvp( "$gte", types::b_oid{ lo } ) );
+            else range.append( kvp( "$gte", types::b_oid{ oid_at( lo_ts + uint32_t( uint64_t( hi_ts - lo_ts + 1 ) * i / n ) ) } ) );
+            if( i == n - 1 ) range.append( kvp( "$lte", types::b_oid{ hi } ) );
+            else range.append( kvp( "$lt", types::b_oid{ oid_at( lo_ts + uint32_t( uint64_t( hi_ts - lo_ts + 1 ) * (i + 1) / n ) ) } ) );
+            auto range_doc = range.extract();
+            scans[i].range = make_document( kvp( "$and", make_array( actions_query, make_document( kvp( "_id", range_doc.view() ) ) ) ) );
+          }
+          // scan order follows the sort
+          if( sort < 0 ) std::reverse( scans.begin(), scans.end() );
+
+          std::vector<std::atomic<size_t>> found( n );
+          std::vector<std::atomic<bool>> complete( n );
+          for( size_t i = 0; i < n; ++i ) {
+            found[i] = 0;
+            complete[i] = false;
+          }
+          // the page is settled for slice i once the finished slices before it hold limit matches
+          auto settled = [&]( size_t i ) {
+            size_t total = 0;
+            for( size_t j = 0; j < i; ++j ) {
+              if( !complete[j] ) return false;
+              total += found[j];
+            }
+            return total >= limit;
+          };
+
+          const action_trace_filter filter( name );
+          auto scan = [&]( size_t i ) {
+            auto& ps = scans[i];
+            auto col = (*clients[i])[history.db_name][history.trans_traces_col];
+            mongocxx::options::find opts;
+            opts.sort( make_document( kvp( "_id", sort )));
+            opts.max_time( ctx.remaining() );
+            stage_clock clock;
+            auto cursor = col.find( ps.range.view(), opts );
+            std::vector<bsoncxx::document::view> matches;
+            size_t skip = i == 0 ? resume_skip : 0;
+            try {
+              for( auto&& doc : cursor ) {
+                clock.lap( ctx.metrics.fetch_us );
+                if( ps.actions.size() >= limit || settled( i ) ) break;
+                add_scanned( ctx, doc );
+                matches.clear();
+                size_t match_no = 0;
+                auto ele = doc["action_traces"];
+                if( ele && ele.type() == type::k_array ) {
+                  filter.collect( ele.get_array().value, matches, skip + limit - ps.actions.size() );
+                  clock.lap( ctx.metrics.filter_us );
+                  const bool compact = compact_schema::is_compact( doc );
+                  for( const auto& trace_view : matches ) {
+                    ++match_no;
+                    if( match_no <= skip ) continue;
+                    ps.actions.emplace_back( to_ordered_action( trace_view, compact ) );
+                    ps.positions.emplace_back( ps.ids.size(), match_no );
+                  }
+                  clock.lap( ctx.metrics.decode_us );
+                  if( match_no > skip )
+                    ps.ids.emplace_back( make_document( kvp( "id", doc["_id"].get_value() ) ) );
+                }
+                ps.stop = make_document( kvp( "id", doc["_id"].get_value() ), kvp( "n", int64_t( std::max( match_no, skip ) ) ) );
+                skip = 0;
+                found[i] = ps.actions.size();
+                if( ctx.expired() ) {
+                  ps.time_limit_exceeded = true;
+                  break;
+                }
+              }
+            } catch( const mongocxx::operation_exception& e ) {
+              if( !max_time_expired( e ) ) throw;
+              ps.time_limit_exceeded = true;
+            }
+            complete[i] = true;
+          };
+
+          // the first slice runs on the calling thread
+          std::vector<std::future<void>> workers;
+          for( size_t i = 1; i < n; ++i ) {
+            auto task = std::make_shared<std::packaged_task<void()>>( [&scan, i] { scan( i ); } );
+            workers.emplace_back( task->get_future() );
+            boost::asio::post( *history.query_pool, [task] { (*task)(); } );
+          }
+          std::exception_ptr error;
+          try {
+            scan( 0 );
+          } catch( ... ) {
+            error = std::current_exception();
+            complete[0] = true;
+          }
+          for( auto& w : workers ) {
+            try {
+              w.get();
+            } catch( ... ) {
+              if( !error ) error = std::current_exception();
+            }
+          }
+          if( error ) std::rethrow_exception( error );
+
+          // merge in slice order
+          const bsoncxx::document::value* stop = nullptr;
+          for( auto& ps : scans ) {
+            for( size_t a = 0; a < ps.actions.size() && result.actions.size() < limit; ++a ) {
+              result.actions.emplace_back( std::move( ps.actions[a] ) );
+              if( result.actions.size() == limit ) {
+                const auto& id = ps.ids[ps.positions[a].first].view()["id"].get_value();
+                result.next_cursor = encode_trace_cursor( name.to_string(), sort, id, int64_t( ps.positions[a].second ) );
+              }
+            }
+            if( result.actions.size() >= limit ) break;
+            if( ps.stop ) stop = &*ps.stop;
+            if( ps.time_limit_exceeded ) {
+              // continue after the last document scanned before running out of time
+              result.time_limit_exceeded_error = true;
+              if( stop )
+                result.next_cursor = encode_trace_cursor( name.to_string(), sort, stop->view()["id"].get_value(),
+                                                          stop->view()["n"].get_int64().value );
+              break;
+            }
+          }
+          return true;
+        }
+
+        /// answer get_actions by scanning transaction_traces for the account
+        read_only::get_actions_result get_traced_actions( const mongo_history_plugin_impl& history,
+                                                          const read_only::get_actions_params& params,
+                                                          const query_context& ctx ) {
           int32_t pos = params.pos ? *params.pos : -1;
           int32_t offset = params.offset ? *params.offset : -20;
          
           auto name = params.account_name;
-          wdump((pos));
-          wdump((offset));
           int32_t sort = 1;
           if( pos < 0 ) {
             // if negative need to reverse sort by id
@@ -126,6 +2289,13 @@ namespace eosio {
             sort = -1;
             pos += 1;
           }
+          // a cursor resumes after the last trace returned, in the direction of the page that issued it
+          fc::optional<bsoncxx::document::value> resume;
+          const auto plan = history.actions_query == actions_query_mode::aggregate ? cursor_plan::aggregate : cursor_plan::trace;
+          if( params.cursor ) {
+            resume = decode_cursor( *params.cursor, name, plan );
+            sort = resume->view()["d"].get_int32().value;
+          }
           /*int32_t end = 0;
           int32_t end = 0;
           if( offset > 0 ) {
@@ -139,168 +2309,805 @@ namespace eosio {
           EOS_ASSERT( end >= start, chain::plugin_exception, "end position is earlier than start position" );
 
           idump((start)(end));*/
-          // get trx traces
-          auto trans_trace = history->mongo_client[history->db_name][history->trans_traces_col];
-          // create options and query docs
-          mongocxx::options::find opts;
-          opts.sort(make_document(kvp("_id", sort)));
-          if(pos != 0 || pos != -1) opts.skip(abs(pos));
-          //opts.limit(abs_offset);
-          bsoncxx::document::value actions_query = make_document(kvp("$or", 
-                      make_array(make_document(kvp("action_traces.act.authorization.actor", string(name))),
-                                 make_document(kvp("action_traces.inline_traces.receipt.receiver", string(name))),
-                                 make_document(kvp("action_traces.receipt.receiver", string(name)))
-                      )));
-          wlog("actions_query: ${s}", ("s", bsoncxx::to_json(actions_query)));
-          auto cursor = trans_trace.find(actions_query.view(), opts);
-          //auto doc_count = trans_trace.count_documents(actions_query);
-          //ilog("cursor.count ${u}", ("u", cursor.size()));
-          get_actions_result result;
-          auto& chain = history->chain_plug->chain();
+          const auto name_value = compact_schema::name_match( name, history.compact_documents );
+          // seek to the document of the last returned trace, its already returned matches are skipped below
+          EOS_ASSERT( history.backend, chain::plugin_config_exception,
+                      "mongo_history_plugin is disabled, no --history-mongodb-uri specified" );
+          const auto actions_query = traced_actions_query( { name }, history.compact_documents, sort, resume );
+          size_t resume_skip = resume ? size_t( resume->view()["n"].get_int64().value ) : 0;
+          if( ctx.traced )
+            ilog( "get_actions ${a} pos ${p} offset ${o} query ${q}", ("a", name)("p", pos)("o", offset)("q", bsoncxx::to_json( actions_query )) );
+          read_only::get_actions_result result;
+          auto& chain = history.chain_plug->chain();
           result.last_irreversible_block = chain.last_irreversible_block_num();
-          int32_t count = 0;
-          auto start_time = fc::time_point::now();
-          auto end_time = start_time;
-          auto abs_offset = abs(offset);
-          for(auto&& doc : cursor){           
-            //ilog("doc: ${s}", ("s", bsoncxx::to_json(doc)));
-            auto ele = doc["action_traces"];
-            if (ele && ele.type() == type::k_array) {
-              for(auto trace : ele.get_array().value ){
+          const size_t abs_offset = abs(offset);
+          result.actions.reserve( abs_offset );
+          // views into the current cursor document, converted before the cursor advances
+          std::vector<bsoncxx::document::view> matches;
+          matches.reserve( abs_offset );
+          const action_trace_filter filter( name );
+
+          auto append_action = [&]( const bsoncxx::document::view& trace_view, bool compact ) {
+            result.actions.emplace_back( to_ordered_action( trace_view, compact ) );
+          };
+          auto set_next_cursor = [&]( const bsoncxx::types::value& id, size_t taken ) {
+            result.next_cursor = encode_trace_cursor( string(name), sort, id, int64_t( taken ), plan );
+          };
+
+          if( history.actions_query == actions_query_mode::aggregate ) {
+            // only the top level traces involving the account directly or through a direct inline
+            // receiver leave the server, nested matches are then picked out of those by the same
+            // filter as the find path. Unlike that path, a top level trace whose only match is deeper
+            // (inline authorizers, notifications of inline actions) is dropped by the $match.
+            mongocxx::pipeline pipeline;
+            pipeline.match( actions_query.view() );
+            pipeline.sort( make_document( kvp( "_id", sort )));
+            if( !resume && pos != 0 ) pipeline.skip( abs(pos) );
+            pipeline.project( make_document( kvp( "schema", 1 ), kvp( "action_traces", 1 )));
+            pipeline.unwind( "$action_traces" );
+            pipeline.match( make_document( kvp( "$or", make_array(
+                  make_document( kvp( "action_traces.act.authorization.actor", name_value.view() )),
+                  make_document( kvp( "action_traces.act.account", name_value.view() )),
+                  make_document( kvp( "action_traces.receipt.receiver", name_value.view() )),
+                  make_document( kvp( "action_traces.inline_traces.receipt.receiver", name_value.view() ))
+                  ))));
+            // every remaining trace yields at least one match
+            pipeline.limit( int32_t( resume_skip + abs_offset ));
+            mongocxx::options::aggregate aggregate_opts;
+            aggregate_opts.max_time( ctx.remaining() );
+            auto client = history.acquire_client();
+            auto trans_trace = (*client)[history.db_name][history.trans_traces_col];
+            stage_clock clock;
+            auto cursor = trans_trace.aggregate( pipeline, aggregate_opts );
+
+            // matches of the current transaction_traces document, returned or skipped
+            fc::optional<bsoncxx::document::value> doc_id;
+            size_t doc_taken = 0;
+            size_t to_skip = 0;
+            try {
+              for( auto&& doc : cursor ) {
+                clock.lap( ctx.metrics.fetch_us );
+                add_scanned( ctx, doc );
+                auto id = doc["_id"].get_value();
+                if( !doc_id || doc_id->view()["id"].get_value() != id ) {
+                  doc_id = make_document( kvp( "id", id ));
+                  doc_taken = 0;
+                  to_skip = resume_skip && id == resume->view()["id"].get_value() ? resume_skip : 0;
+                  resume_skip = 0;
+                }
+                auto ele = doc["action_traces"];
+                matches.clear();
+                if( ele && ele.type() == type::k_document )
+                  filter.collect( ele.get_document().value, matches, to_skip + abs_offset - result.actions.size() );
+                clock.lap( ctx.metrics.filter_us );
+                for( const auto& trace_view : matches ) {
+                  ++doc_taken;
+                  if( to_skip ) {
+                    --to_skip;
+                    continue;
+                  }
+                  append_action( trace_view, compact_schema::is_compact( doc ) );
+                }
+                clock.lap( ctx.metrics.decode_us );
+                if( result.actions.size() >= abs_offset ) {
+                  set_next_cursor( id, doc_taken );
+                  break;
+                }
+                if( ctx.expired() ) {
+                  result.time_limit_exceeded_error = true;
+                  break;
+                }
+              }
+            } catch( const mongocxx::operation_exception& e ) {
+              if( !max_time_expired( e ) ) throw;
+              result.time_limit_exceeded_error = true;
+            }
+            // a partial page continues after the last trace seen, traces of one document arrive together
+            if( result.time_limit_exceeded_error && doc_id )
+              set_next_cursor( doc_id->view()["id"].get_value(), doc_taken + to_skip );
+            return result;
+          }
+
+          if( history.query_parallelism > 1 && (resume || pos == 0) ) {
+            if( get_partitioned_actions( history, name, sort, actions_query.view(), resume, resume_skip, abs_offset, ctx, result ) )
+              return result;
+          }
+
+          history_backend::trace_scan scan;
+          scan.account = name;
+          scan.sort = sort;
+          if( !resume && pos != 0 ) scan.skip = size_t( abs(pos) );
+          if( resume ) scan.from_id = make_document( kvp( "id", resume->view()["id"].get_value() ) );
+          scan.max_time = ctx.remaining();
+          stage_clock clock;
+          // last document scanned and the number of its matches returned or skipped
+          fc::optional<bsoncxx::document::value> scanned;
+          try {
+            history.backend->scan_traces( scan, [&]( const bsoncxx::document::view& doc ) {
+              clock.lap( ctx.metrics.fetch_us );
+              add_scanned( ctx, doc );
+              size_t skip = 0;
+              if( resume_skip ) {
+                if( doc["_id"].get_value() == resume->view()["id"].get_value() ) skip = resume_skip;
+                resume_skip = 0;
+              }
+              auto ele = doc["action_traces"];
+              matches.clear();
+              if (ele && ele.type() == type::k_array) {
+                filter.collect( ele.get_array().value, matches, skip + abs_offset - result.actions.size() );
+                clock.lap( ctx.metrics.filter_us );
+                const bool compact = compact_schema::is_compact( doc );
+                for( auto itr = matches.begin() + std::min( skip, matches.size() ); itr != matches.end(); ++itr ) {
+                  append_action( *itr, compact );
+                }
+                clock.lap( ctx.metrics.decode_us );
+              }
+              if( result.actions.size() >= abs_offset ) {
+                set_next_cursor( doc["_id"].get_value(), matches.size() );
+                return false;
+              }
+              // bail out, the page continues from here
+              if( ctx.expired() ) {
+                result.time_limit_exceeded_error = true;
+                set_next_cursor( doc["_id"].get_value(), std::max( skip, matches.size() ) );
+                return false;
+              }
+              scanned = make_document( kvp( "id", doc["_id"].get_value() ), kvp( "n", int64_t( std::max( skip, matches.size() ) ) ) );
+              return true;
+            });
+          } catch( const mongocxx::operation_exception& e ) {
+            if( !max_time_expired( e ) ) throw;
+            result.time_limit_exceeded_error = true;
+            if( scanned )
+              set_next_cursor( scanned->view()["id"].get_value(), size_t( scanned->view()["n"].get_int64().value ) );
+          }
+          return result;
+        }
+
+        /// accounts one get_accounts_actions request may ask for
+        const size_t max_batch_accounts = 1000;
+
+        /// staged actions are newer than everything in MongoDB, merge them into the newest page of an account
+        /**
+         *  Adds the actions of staged blocks to a first page. The page grows by them instead of dropping
+         *  stored actions, so next_cursor still continues right after the last stored action returned.
+         */
+        void merge_staged_actions( const mongo_history_plugin_impl& history, const account_name& n,
+                                   read_only::get_actions_result& result ) {
+          vector<read_only::ordered_action_result> staged;
+          history.add_staged_actions( n, staged );
+          if( staged.empty() ) return;
+          if( history.store_account_actions ) {
+            // ascending pages, staged actions continue the account sequence where the writer will
+            int64_t seq = 0;
+            if( !result.actions.empty() ) {
+              seq = result.actions.back().account_action_seq + 1;
+            } else {
+              auto client = history.acquire_client();
+              auto account_actions = (*client)[history.db_name][history.account_actions_col];
+              seq = history.stored_action_seq_end( account_actions, n );
+            }
+            for( auto& a : staged ) {
+              a.account_action_seq = int32_t( seq++ );
+              result.actions.emplace_back( std::move( a ) );
+            }
+          } else {
+            // newest first
+            result.actions.insert( result.actions.begin(), std::make_move_iterator( staged.rbegin() ),
+                                   std::make_move_iterator( staged.rend() ) );
+          }
+        }
+
+        /**
+         *  Answer the pages of a get_accounts_actions request from account_actions in three round trips:
+         *  the newest sequence of every account paged from its end, the rows of all pages as one $or of
+         *  ranges and the referenced traces as one $in.
+         */
+        std::vector<read_only::get_actions_result> get_indexed_batch( const mongo_history_plugin_impl& history,
+                                                                      const vector<read_only::account_actions_page>& pages,
+                                                                      const query_context& ctx ) {
+          auto client = history.acquire_client();
+          auto db = (*client)[history.db_name];
+          auto account_actions = db[history.account_actions_col];
+
+          std::vector<read_only::get_actions_result> results( pages.size() );
+          const uint32_t lib = history.chain_plug->chain().last_irreversible_block_num();
+          for( auto& r : results ) {
+            r.last_irreversible_block = lib;
+          }
+
+          stage_clock clock;
+          std::set<account_name> from_end;
+          for( const auto& p : pages ) {
+            if( !p.pos || *p.pos == -1 ) from_end.insert( p.account_name );
+          }
+          std::map<account_name, int64_t> last_seqs;
+          if( !from_end.empty() ) {
+            bsoncxx::builder::basic::array names;
+            for( const auto& n : from_end ) {
+              names.append( n.to_string() );
+              if( history.compact_documents ) names.append( types::b_int64{ int64_t( n.value ) } );
+            }
+            // $first after sorting on the {account, account_action_seq} index is answered by a DISTINCT_SCAN
+            mongocxx::pipeline pipeline;
+            pipeline.match( make_document( kvp( "account", make_document( kvp( "$in", names ) ) ) ) );
+            pipeline.sort( make_document( kvp( "account", 1 ), kvp( "account_action_seq", -1 ) ) );
+            pipeline.group( make_document( kvp( "_id", "$account" ),
+                                           kvp( "seq", make_document( kvp( "$first", "$account_action_seq" ) ) ) ) );
+            mongocxx::options::aggregate aggregate_opts;
+            aggregate_opts.max_time( ctx.remaining() );
+            for( auto&& doc : account_actions.aggregate( pipeline, aggregate_opts ) ) {
+              add_scanned( ctx, doc );
+              // an account stored in both schemas forms two groups
+              auto& seq = last_seqs[compact_schema::to_name( doc["_id"] )];
+              seq = std::max( seq, doc["seq"].get_int64().value );
+            }
+          }
+
+          std::vector<std::pair<int32_t, int32_t>> ranges;
+          ranges.reserve( pages.size() );
+          bsoncxx::builder::basic::array clauses;
+          for( const auto& p : pages ) {
+            fc::optional<int64_t> last_seq;
+            auto itr = last_seqs.find( p.account_name );
+            if( itr != last_seqs.end() ) last_seq = itr->second;
+            ranges.emplace_back( action_seq_range( p.pos ? *p.pos : -1, p.offset ? *p.offset : -20, last_seq ) );
+            clauses.append( make_document( kvp( "account", compact_schema::name_match( p.account_name, history.compact_documents ) ),
+                                           kvp( "account_action_seq", make_document( kvp( "$gte", int64_t( ranges.back().first ) ),
+                                                                                     kvp( "$lte", int64_t( ranges.back().second ) ) ) ) ) );
+          }
+          mongocxx::options::find opts;
+          opts.max_time( ctx.remaining() );
+          std::vector<bsoncxx::document::value> rows;
+          for( auto&& row : account_actions.find( make_document( kvp( "$or", clauses ) ), opts ) ) {
+            add_scanned( ctx, row );
+            rows.emplace_back( row );
+          }
+          clock.lap( ctx.metrics.fetch_us );
+          if( rows.empty() ) return results;
+          const auto traces = fetch_row_traces( history, db, rows, ctx );
+
+          // sorted by account and sequence every page is a contiguous run of rows, names of both
+          // schemas are ordered by their value
+          using row_key = std::pair<uint64_t, int64_t>;
+          auto key_of = []( const bsoncxx::document::value& row ) {
+            return row_key( compact_schema::to_name( row.view()["account"] ).value, row.view()["account_action_seq"].get_int64().value );
+          };
+          std::vector<std::pair<row_key, bsoncxx::document::view>> sorted;
+          sorted.reserve( rows.size() );
+          for( const auto& row : rows ) {
+            sorted.emplace_back( key_of( row ), row.view() );
+          }
+          std::sort( sorted.begin(), sorted.end(), []( const auto& a, const auto& b ) { return a.first < b.first; } );
+          for( size_t i = 0; i < pages.size(); ++i ) {
+            const string account = pages[i].account_name.to_string();
+            const uint64_t value = pages[i].account_name.value;
+            auto itr = std::lower_bound( sorted.begin(), sorted.end(), row_key( value, ranges[i].first ),
+                                         []( const auto& row, const row_key& k ) { return row.first < k; } );
+            std::vector<bsoncxx::document::view> views;
+            for( ; itr != sorted.end() && itr->first <= row_key( value, ranges[i].second ); ++itr ) {
+              views.emplace_back( itr->second );
+            }
+            const int32_t direction = (pages[i].offset ? *pages[i].offset : -20) < 0 ? -1 : 1;
+            convert_rows( views, direction, traces, account, ctx, results[i] );
+          }
+          return results;
+        }
+
+        /**
+         *  Matches action traces against a set of accounts in one pass over a transaction_traces
+         *  document, names are looked up as string views into the BSON buffer or by their value.
+         */
+        class account_set_filter {
+          public:
+            explicit account_set_filter( std::vector<string> account_names )
+            :names( std::move( account_names ) ) {
+              for( size_t i = 0; i < names.size(); ++i ) {
+                slots.emplace( bsoncxx::stdx::string_view( names[i] ), i );
+                values.emplace( account_name( names[i] ).value, i );
+              }
+            }
+
+            /// calls f( slot, trace ) for every trace and inline trace involving an account, in execution order
+            template<typename F>
+            void for_each_match( const bsoncxx::array::view& traces, F&& f )const {
+              std::vector<size_t> hits;
+              for_each_match( traces, f, hits );
+            }
+
+          private:
+            template<typename F>
+            void for_each_match( const bsoncxx::array::view& traces, F& f, std::vector<size_t>& hits )const {
+              for( auto trace : traces ) {
                 auto trace_view = trace.get_document().view();
-                // check authorizations
-                bool is_authorizer = false;
+                hits.clear();
+                add_hit( trace_view["receipt"]["receiver"], hits );
+                add_hit( trace_view["act"]["account"], hits );
                 auto auths = trace_view["act"]["authorization"];
-                if (auths && auths.type() == type::k_array) {
-                  for(auto auth : auths.get_array().value ){
-                    if(auth["actor"].get_utf8().value.to_string() == name){
-                      is_authorizer = true;
-                      wlog("found authorizer");
-                      break;
-                    }
+                if( auths && auths.type() == type::k_array ) {
+                  for( auto auth : auths.get_array().value ) {
+                    add_hit( auth["actor"], hits );
                   }
                 }
-                // confirm act.account and receipt.receiver contain the user
-                if(trace_view["act"]["account"].get_utf8().value.to_string() == name ||
-                   trace_view["receipt"]["receiver"].get_utf8().value.to_string() == name ||
-                   is_authorizer )
-                   {
-                  result.actions.emplace_back( ordered_action_result{
-                                 uint32_t(trace_view["receipt"]["global_sequence"].get_value().get_int32()),
-                                 trace_view["receipt"]["global_sequence"].get_value().get_int32(),
-                                 uint32_t(trace_view["block_num"].get_value().get_int32()), 
-                                 chain::block_timestamp_type(fc::time_point::from_iso_string(trace_view["block_time"].get_utf8().value.to_string())),
-                                 fc::json::from_string(bsoncxx::to_json(trace_view))
-                                 });
-                  count++;
-                  if(count > abs_offset){
-                    break;
-                  }
+                for( auto slot : hits ) {
+                  f( slot, trace_view );
+                }
+                auto inlines = trace_view["inline_traces"];
+                if( inlines && inlines.type() == type::k_array )
+                  for_each_match( inlines.get_array().value, f, hits );
+              }
+            }
+
+            void add_hit( const bsoncxx::document::element& ele, std::vector<size_t>& hits )const {
+              if( !ele ) return;
+              size_t slot;
+              if( ele.type() == type::k_utf8 ) {
+                auto itr = slots.find( bsoncxx::stdx::string_view( ele.get_utf8().value ) );
+                if( itr == slots.end() ) return;
+                slot = itr->second;
+              } else if( ele.type() == type::k_int64 ) {
+                auto itr = values.find( uint64_t( ele.get_int64().value ) );
+                if( itr == values.end() ) return;
+                slot = itr->second;
+              } else {
+                return;
+              }
+              if( std::find( hits.begin(), hits.end(), slot ) == hits.end() )
+                hits.push_back( slot );
+            }
+
+            struct view_hash {
+              size_t operator()( const bsoncxx::stdx::string_view& v )const {
+                return std::hash<std::string>()( std::string( v.data(), v.size() ) );
+              }
+            };
+
+            std::vector<string>                                                 names;
+            std::unordered_map<bsoncxx::stdx::string_view, size_t, view_hash>  slots;
+            std::unordered_map<uint64_t, size_t>                                values;   ///< compact schema
+        };
+
+        /**
+         *  Answer the pages of a get_accounts_actions request by scanning transaction_traces. The newest
+         *  pages of all accounts share one newest-first trace_scan of all the accounts that stops once
+         *  every page is full, pages at a pos are answered one by one like get_actions.
+         */
+        std::vector<read_only::get_actions_result> get_traced_batch( const mongo_history_plugin_impl& history,
+                                                                     const vector<read_only::account_actions_page>& pages,
+                                                                     const query_context& ctx ) {
+          std::vector<read_only::get_actions_result> results( pages.size() );
+          const uint32_t lib = history.chain_plug->chain().last_irreversible_block_num();
+
+          // one slot per distinct account of the shared scan, sized for its largest page
+          struct slot {
+            size_t                                           limit = 0;
+            std::vector<read_only::ordered_action_result>    actions;
+            std::vector<std::pair<size_t, size_t>>           positions;  ///< per action: index into ids, match number in its document
+            size_t                                           doc_matches = 0;
+          };
+          std::vector<string> names;
+          std::vector<slot> slots;
+          std::vector<size_t> slot_of( pages.size(), std::numeric_limits<size_t>::max() );
+          for( size_t i = 0; i < pages.size(); ++i ) {
+            const auto& p = pages[i];
+            if( p.pos && *p.pos != -1 ) {
+              read_only::get_actions_params params;
+              params.account_name = p.account_name;
+              params.pos = p.pos;
+              params.offset = p.offset;
+              results[i] = get_traced_actions( history, params, ctx );
+              continue;
+            }
+            const string account = p.account_name.to_string();
+            auto itr = std::find( names.begin(), names.end(), account );
+            slot_of[i] = itr - names.begin();
+            if( itr == names.end() ) {
+              names.push_back( account );
+              slots.emplace_back();
+            }
+            auto& s = slots[slot_of[i]];
+            s.limit = std::max<size_t>( s.limit, std::abs( p.offset ? *p.offset : -20 ) );
+          }
+          if( !names.empty() ) {
+            history_backend::trace_scan scan;
+            for( const auto& n : names ) {
+              scan.accounts.emplace_back( n );
+            }
+            scan.max_time = ctx.remaining();
+
+            const account_set_filter filter( names );
+            stage_clock clock;
+            std::vector<bsoncxx::document::value> ids;
+            fc::optional<bsoncxx::document::value> scanned;   ///< last document scanned completely
+            std::vector<size_t> touched;
+            size_t pending = slots.size();
+            bool time_limit_exceeded = false;
+            try {
+              history.backend->scan_traces( scan, [&]( const bsoncxx::document::view& doc ) {
+                clock.lap( ctx.metrics.fetch_us );
+                add_scanned( ctx, doc );
+                for( auto t : touched ) {
+                  slots[t].doc_matches = 0;
                 }
-              } 
-            }           
-            // bail out 
-            end_time = fc::time_point::now();
-            if( end_time - start_time > fc::microseconds(100000) ) {
+                touched.clear();
+                bool matched = false;
+                auto ele = doc["action_traces"];
+                const bool compact = compact_schema::is_compact( doc );
+                if( ele && ele.type() == type::k_array ) {
+                  filter.for_each_match( ele.get_array().value, [&]( size_t t, const bsoncxx::document::view& trace_view ) {
+                    auto& s = slots[t];
+                    if( s.actions.size() >= s.limit ) return;
+                    if( s.doc_matches++ == 0 ) touched.push_back( t );
+                    s.actions.emplace_back( to_ordered_action( trace_view, compact ) );
+                    s.positions.emplace_back( ids.size(), s.doc_matches );
+                    if( s.actions.size() == s.limit ) --pending;
+                    matched = true;
+                  });
+                  // matches are converted as they are found, both count as filtering
+                  clock.lap( ctx.metrics.filter_us );
+                }
+                if( matched ) ids.emplace_back( make_document( kvp( "id", doc["_id"].get_value() ) ) );
+                scanned = make_document( kvp( "id", doc["_id"].get_value() ) );
+                if( pending == 0 ) return false;
+                if( ctx.expired() ) {
+                  time_limit_exceeded = true;
+                  return false;
+                }
+                return true;
+              });
+            } catch( const mongocxx::operation_exception& e ) {
+              if( !max_time_expired( e ) ) throw;
+              time_limit_exceeded = true;
+            }
+
+            for( size_t i = 0; i < pages.size(); ++i ) {
+              if( slot_of[i] == std::numeric_limits<size_t>::max() ) continue;
+              auto& s = slots[slot_of[i]];
+              auto& r = results[i];
+              const size_t limit = std::abs( pages[i].offset ? *pages[i].offset : -20 );
+              const size_t n = std::min( limit, s.actions.size() );
+              r.actions.assign( s.actions.begin(), s.actions.begin() + n );
+              if( n == limit && n > 0 ) {
+                const auto& pos = s.positions[n - 1];
+                r.next_cursor = encode_trace_cursor( names[slot_of[i]], -1, ids[pos.first].view()["id"].get_value(),
+                                                     int64_t( pos.second ) );
+              } else if( time_limit_exceeded ) {
+                // continue after the last document scanned before running out of time
+                r.time_limit_exceeded_error = true;
+                if( scanned )
+                  r.next_cursor = encode_trace_cursor( names[slot_of[i]], -1, scanned->view()["id"].get_value(),
+                                                       int64_t( s.doc_matches ) );
+              }
+            }
+          }
+          for( auto& r : results ) {
+            r.last_irreversible_block = lib;
+          }
+          return results;
+        }
+      }
+
+        read_only::get_actions_result read_only::get_actions( const read_only::get_actions_params& params )const {
+          const query_context ctx( *history, params.time_limit_ms );
+          metrics_scope scope{ "get_actions", history->get_actions_metrics, ctx };
+          if( !history->may_have_history( params.account_name ) ) {
+            get_actions_result result;
+            result.last_irreversible_block = history->chain_plug->chain().last_irreversible_block_num();
+            return result;
+          }
+          // the first page of an account is cached until the head block changes
+          const bool first_page = !params.cursor && (!params.pos || *params.pos == -1);
+          string cache_key;
+          if( first_page && history->actions_cache ) {
+            cache_key = params.account_name.to_string() + ":" + std::to_string( params.offset ? *params.offset : -20 );
+            if( auto cached = history->actions_cache->get( cache_key, history->head_block_num, fc::time_point::now() ) ) {
+              scope.returned = cached->actions.size();
+              // the page may be older than the current last irreversible block
+              auto result = *cached;
+              result.last_irreversible_block = history->lib_block_num;
+              return result;
+            }
+          }
+
+          // identical requests in flight share one query
+          const string flight_key = params.account_name.to_string() + ":" + (params.pos ? std::to_string( *params.pos ) : "") + ":" +
+                                    (params.offset ? std::to_string( *params.offset ) : "") + ":" +
+                                    (params.time_limit_ms ? std::to_string( *params.time_limit_ms ) : "") + ":" +
+                                    (params.cursor ? *params.cursor : "");
+          auto shared = history->actions_flights.run( flight_key, [&]() -> get_actions_result {
+            get_actions_result result;
+            try {
+              result = history->store_account_actions ? get_indexed_actions( *history, params, ctx )
+                                                      : get_traced_actions( *history, params, ctx );
+            } catch( const mongocxx::operation_exception& e ) {
+              if( !max_time_expired( e ) ) throw;
+              result.last_irreversible_block = history->chain_plug->chain().last_irreversible_block_num();
               result.time_limit_exceeded_error = true;
-              break;
-           }
+            }
+            // out of time before anything was scanned, the same page is requested again
+            if( result.time_limit_exceeded_error && !result.next_cursor )
+              result.next_cursor = params.cursor;
+
+            if( first_page && history->irreversible_only )
+              merge_staged_actions( *history, params.account_name, result );
+
+            if( !cache_key.empty() && !result.time_limit_exceeded_error ) {
+              history->actions_cache->put( cache_key, std::make_shared<get_actions_result>( result ), fc::raw::pack_size( result ),
+                                           true, history->head_block_num, fc::time_point::now() + history->reversible_cache_ttl );
+            }
+            return result;
+          });
+          scope.returned = shared->actions.size();
+          return *shared;
+        }
+
+        read_only::get_accounts_actions_result read_only::get_accounts_actions( const read_only::get_accounts_actions_params& params )const {
+          EOS_ASSERT( params.accounts.size() <= max_batch_accounts, chain::plugin_exception,
+                      "get_accounts_actions is limited to ${n} accounts", ("n", max_batch_accounts) );
+          const query_context ctx( *history, params.time_limit_ms );
+          metrics_scope scope{ "get_accounts_actions", history->get_accounts_actions_metrics, ctx };
+
+          // accounts certainly without history get an empty page without being queried
+          std::vector<account_actions_page> queried;
+          std::vector<size_t> queried_index;
+          for( size_t i = 0; i < params.accounts.size(); ++i ) {
+            if( !history->may_have_history( params.accounts[i].account_name ) ) continue;
+            queried.push_back( params.accounts[i] );
+            queried_index.push_back( i );
+          }
+
+          std::vector<get_actions_result> pages( params.accounts.size() );
+          if( !queried.empty() ) {
+            std::vector<get_actions_result> queried_pages;
+            try {
+              queried_pages = history->store_account_actions ? get_indexed_batch( *history, queried, ctx )
+                                                             : get_traced_batch( *history, queried, ctx );
+            } catch( const mongocxx::operation_exception& e ) {
+              if( !max_time_expired( e ) ) throw;
+              queried_pages.assign( queried.size(), get_actions_result() );
+              for( auto& p : queried_pages ) {
+                p.time_limit_exceeded_error = true;
+              }
+            }
+            for( size_t i = 0; i < queried_pages.size(); ++i ) {
+              pages[queried_index[i]] = std::move( queried_pages[i] );
+            }
+          }
+
+          get_accounts_actions_result result;
+          result.last_irreversible_block = history->chain_plug->chain().last_irreversible_block_num();
+          result.accounts.reserve( pages.size() );
+          for( size_t i = 0; i < pages.size(); ++i ) {
+            const auto& p = params.accounts[i];
+            if( history->irreversible_only && (!p.pos || *p.pos == -1) )
+              merge_staged_actions( *history, p.account_name, pages[i] );
+            scope.returned += pages[i].actions.size();
+            result.accounts.emplace_back( account_actions_result{ p.account_name, std::move( pages[i].actions ),
+                                                                  pages[i].time_limit_exceeded_error, pages[i].next_cursor } );
           }
           return result;
         }
 
+      namespace {
+        /// look for the transaction in the hinted block of the local chain, reversible blocks included
+        fc::optional<read_only::get_transaction_result> get_transaction_from_block( const chain_plugin& chain_plug, const string& id,
+                                                                                     uint32_t block_num ) {
+          const auto& chain = chain_plug.chain();
+          signed_block_ptr blk;
+          try {
+            blk = chain.fetch_block_by_number( block_num );
+          } catch( const fc::exception& e ) {
+            wlog( "Unable to fetch block ${n} for transaction ${id}: ${e}", ("n", block_num)("id", id)("e", e.to_string()) );
+          }
+          if( !blk ) return {};
+
+          auto id_matches = [&]( const transaction_id_type& trx_id ) {
+            return trx_id.str().compare( 0, id.size(), id ) == 0;
+          };
+          for( const auto& receipt : blk->transactions ) {
+            read_only::get_transaction_result result;
+            if( receipt.trx.contains<packed_transaction>() ) {
+              const auto& pt = receipt.trx.get<packed_transaction>();
+              if( !id_matches( pt.id() ) ) continue;
+              result.id = pt.id();
+              result.trx = chain.to_variant_with_abi( fc::mutable_variant_object( "receipt", receipt )( "trx", pt.get_signed_transaction() ),
+                                                      chain_plug.get_abi_serializer_max_time() );
+            } else {
+              const auto& trx_id = receipt.trx.get<transaction_id_type>();
+              if( !id_matches( trx_id ) ) continue;
+              result.id = trx_id;
+              result.trx = chain.to_variant_with_abi( fc::mutable_variant_object( "receipt", receipt ),
+                                                      chain_plug.get_abi_serializer_max_time() );
+            }
+            result.block_num = block_num;
+            result.block_time = blk->timestamp;
+            result.last_irreversible_block = chain.last_irreversible_block_num();
+            return result;
+          }
+          return {};
+        }
+      }
+
         read_only::get_transaction_result read_only::get_transaction( const read_only::get_transaction_params& params )const {
           // 
           auto& chain = history->chain_plug->chain();
           //transaction_id_type input_id;
           auto input_id_length = params.id.size();
+          // ids are stored as lowercase hex
+          const string id = boost::algorithm::to_lower_copy( params.id );
           try {
             FC_ASSERT( input_id_length <= 64, "hex string is too long to represent an actual transaction id" );
             FC_ASSERT( input_id_length >= 8,  "hex string representing transaction id should be at least 8 characters long to avoid excessive collisions" );
+            FC_ASSERT( std::all_of( id.begin(), id.end(), []( char c ) { return std::isxdigit( static_cast<unsigned char>( c ) ); } ),
+                       "transaction id must be a hex string" );
             //input_id = transaction_id_type(params.id);
           } EOS_RETHROW_EXCEPTIONS(transaction_id_type_exception, "Invalid transaction ID: ${transaction_id}", ("transaction_id", params.id))
 
-          //auto regex_str = b_regex("^" + params.id , "");
-          auto regex_str = "^" + params.id + ".*";
-          ilog("looking up id: ${s}", ("s", regex_str ));
-          // get trx
-          auto trans = history->mongo_client[history->db_name][history->trans_col];
-          auto doc_trx = trans.find_one(make_document(kvp("trx_id", b_regex{"^" + params.id + ".*"})));
-          // get trx traces
-          auto trans_trace = history->mongo_client[history->db_name][history->trans_traces_col];
-          auto doc_trace = trans_trace.find_one(make_document(kvp("id", b_regex{"^" + params.id + ".*"})));
-
-          if (!doc_trx && !params.block_num_hint )  {
-            EOS_THROW(tx_not_found, "Transaction ${id} not found in history or in block number ${n}", ("id",params.id)("n", *params.block_num_hint));
-          }
-          //ilog("doc_trx: ${s}", ("s", bsoncxx::to_json(*doc_trx)));
-          //ilog("doc_trace: ${s}", ("s", bsoncxx::to_json(*doc_trace)));
-          get_transaction_result result;
-          if(doc_trx) {
-            auto trx_view = doc_trx->view();
-            auto trace_view = doc_trace->view();
-            // merge receipt with trx 
-            bsoncxx::builder::stream::document result_doc{};
-            result_doc << "receipt" << trace_view["receipt"].get_document() << 
-                          "trx" << open_document << concatenate(trx_view) << close_document;
-            // setup resuls
-            result.id         = transaction_id_type(trace_view["id"].get_value().get_utf8().value.to_string());
-            result.last_irreversible_block = chain.last_irreversible_block_num();
-            result.block_num  = trace_view["block_num"].get_value().get_int64();
-            // TODO get correct time
-            result.block_time = chain::block_timestamp_type(fc::time_point::from_iso_string(trace_view["block_time"].get_utf8().value.to_string()));
-            // take trx json string to json
-            result.trx = fc::json::from_string(bsoncxx::to_json(result_doc.view()));
-            // get the inline traces
-            auto ele = trace_view["action_traces"];
-            if (ele && ele.type() == type::k_array) {
-              for(auto trace : ele.get_array().value ){
-                result.traces.emplace_back(fc::json::from_string(bsoncxx::to_json(trace.get_document().view())));
-              } 
-            }
-          }
-          else  {
-            elog("TODO: doc is incorrect");
+          const query_context ctx( *history, {} );
+          metrics_scope scope{ "get_transaction", history->get_transaction_metrics, ctx };
+          if( ctx.traced ) ilog( "get_transaction ${id}", ("id", id) );
+          // entries are keyed by the full id, a prefix may match another transaction stored later
+          if( history->trx_cache && id.size() == 64 ) {
+            if( auto cached = history->trx_cache->get( id, history->head_block_num, fc::time_point::now() ) ) {
+              scope.returned = 1;
+              // irreversible entries stay cached for hours, the last irreversible block moves on
+              auto result = *cached;
+              result.last_irreversible_block = history->lib_block_num;
+              return result;
+            }
           }
-          return result;
+          if( history->irreversible_only ) {
+            // reversible history is not in MongoDB yet
+            auto staged = history->find_staged_transaction( id );
+            if( staged ) {
+              scope.returned = 1;
+              return *staged;
+            }
+          }
+          // identical requests in flight share one lookup
+          const string flight_key = id + ":" + (params.block_num_hint ? std::to_string( *params.block_num_hint ) : "");
+          auto shared = history->trx_flights.run( flight_key, [&]() -> get_transaction_result {
+            // recently submitted transactions are served from the chain, traces are only available from history
+            if( params.block_num_hint ) {
+              auto result = get_transaction_from_block( *history->chain_plug, id, *params.block_num_hint );
+              if( result ) return *result;
+            }
+            EOS_ASSERT( history->backend, chain::plugin_config_exception,
+                        "mongo_history_plugin is disabled, no --history-mongodb-uri specified" );
+            stage_clock clock;
+            // two traces tell a prefix collision from a transaction traced twice
+            auto docs = history->backend->find_transaction_traces( id, 2 );
+
+            fc::optional<bsoncxx::document::value> doc_trace;
+            for( auto& doc : docs ) {
+              add_scanned( ctx, doc.view() );
+              if( !doc_trace ) {
+                doc_trace = std::move( doc );
+              } else {
+                // the same transaction may have been traced more than once, a different id is a collision
+                EOS_ASSERT( doc_trace->view()["id"].get_value() == doc.view()["id"].get_value(), transaction_id_type_exception,
+                            "Transaction ID prefix ${id} matches more than one transaction", ("id", params.id) );
+              }
+            }
+            clock.lap( ctx.metrics.fetch_us );
+
+            fc::optional<bsoncxx::document::view> doc_trx;
+            if( doc_trace ) {
+              auto trx = doc_trace->view()["trx"];
+              if( trx && trx.type() == type::k_array && !trx.get_array().value.empty() )
+                doc_trx = trx.get_array().value[0].get_document().value;
+            }
+
+            if (!doc_trx)  {
+              EOS_THROW(tx_not_found, "Transaction ${id} not found in history", ("id",params.id));
+            }
+            get_transaction_result result;
+            if(doc_trx) {
+              auto trx_view = *doc_trx;
+              auto trace_view = doc_trace->view();
+              // setup resuls
+              result.id         = transaction_id_type(trace_view["id"].get_value().get_utf8().value.to_string());
+              result.last_irreversible_block = chain.last_irreversible_block_num();
+              result.block_num  = uint32_t( to_uint64( trace_view["block_num"] ) );
+              result.block_time = compact_schema::to_block_time( trace_view["block_time"] );
+              const bool compact = compact_schema::is_compact( trace_view );
+              // merge receipt with trx
+              result.trx = fc::mutable_variant_object( "receipt", compact_schema::to_variant( trace_view["receipt"].get_document().value, compact ) )
+                                                     ( "trx", from_bson( trx_view ) );
+              // get the inline traces
+              auto ele = trace_view["action_traces"];
+              if (ele && ele.type() == type::k_array) {
+                for(auto trace : ele.get_array().value ){
+                  result.traces.emplace_back( compact_schema::to_variant( trace.get_document().view(), compact ) );
+                } 
+              }
+              clock.lap( ctx.metrics.decode_us );
+            }
+            if( history->trx_cache ) {
+              // irreversible transactions can not change and are kept until evicted
+              const bool reversible = result.block_num > history->lib_block_num;
+              history->trx_cache->put( result.id.str(), std::make_shared<get_transaction_result>( result ), fc::raw::pack_size( result ),
+                                       reversible, history->head_block_num, fc::time_point::now() + history->reversible_cache_ttl );
+            }
+            return result;
+          });
+          scope.returned = 1;
+          return *shared;
         }
 
         read_only::get_key_accounts_results read_only::get_key_accounts(const get_key_accounts_params& params) const {
-          
-          string pub_key = string(params.public_key);
-          ilog("get_key_accounts_results: ${s}", ("s",pub_key));
-          // get mongo collection and query
-          // db.pub_keys.find({"public_key":"EOS7p6AYJLZvTWKBnPHMY3ytmXkuyY55cz7XsSpFEKTyz5pZQiBhy"}) 
-          auto pub_keys = history->mongo_client[history->db_name][history->pub_keys_col];
-          auto cursor = pub_keys.find(make_document(kvp("public_key", pub_key)));
-
+          const query_context ctx( *history, {} );
+          metrics_scope scope{ "get_key_accounts", history->get_key_accounts_metrics, ctx };
           std::set<account_name> accounts;
-          for(auto doc : cursor){
-            ilog("doc: ${s}", ("s", bsoncxx::to_json(doc)));  
-            accounts.insert(doc["account"].get_value().get_utf8().value.to_string());
+          if( history->synthetic ) {
+            const auto key = string( params.public_key );
+            history->backend->for_each_pub_key( [&]( const bsoncxx::document::view& doc ) {
+              if( doc["public_key"].get_utf8().value.to_string() == key )
+                accounts.insert( compact_schema::to_name( doc["account"] ) );
+              return true;
+            });
+          } else {
+            const auto& db = history->chain_plug->chain().db();
+            const auto& pub_key_idx = db.get_index<public_key_history_multi_index, by_pub_key>();
+            auto range = pub_key_idx.equal_range( params.public_key );
+            for( auto obj = range.first; obj != range.second; ++obj )
+              accounts.insert( obj->name );
           }
-        
+          scope.returned = accounts.size();
           return {vector<account_name>(accounts.begin(), accounts.end())};
         }
 
         read_only::get_controlled_accounts_results read_only::get_controlled_accounts(const get_controlled_accounts_params& params) const {
-          
-          string account = string(params.controlling_account);
-          ilog("get_controlled_accounts_results: ${s}", ("s", account));
-          // get mongo collection and query
-          // db.account_controls.find({"controlling_account":"eosnewyorkio"})
-          auto acct_ctrl = history->mongo_client[history->db_name][history->account_controls_col];
-          auto cursor = acct_ctrl.find(make_document(kvp("controlling_account", account)));
-
+          const query_context ctx( *history, {} );
+          metrics_scope scope{ "get_controlled_accounts", history->get_controlled_accounts_metrics, ctx };
           std::set<account_name> accounts;
-          for(auto doc : cursor){
-            ilog("doc: ${s}", ("s", bsoncxx::to_json(doc)));
-            accounts.insert(doc["controlled_account"].get_value().get_utf8().value.to_string());
+          if( history->synthetic ) {
+            history->backend->for_each_account_control( [&]( const bsoncxx::document::view& doc ) {
+              if( compact_schema::to_name( doc["controlling_account"] ) == params.controlling_account )
+                accounts.insert( compact_schema::to_name( doc["controlled_account"] ) );
+              return true;
+            });
+          } else {
+            const auto& db = history->chain_plug->chain().db();
+            const auto& account_control_idx = db.get_index<account_control_history_multi_index, by_controlling>();
+            auto range = account_control_idx.equal_range( params.controlling_account );
+            for( auto obj = range.first; obj != range.second; ++obj )
+              accounts.insert( obj->controlled_account );
           }
-          
+          scope.returned = accounts.size();
           return {vector<account_name>(accounts.begin(), accounts.end())};
         }
 
+        read_only::get_stats_result read_only::get_stats( const read_only::get_stats_params& )const {
+          get_stats_result result;
+          auto add_endpoint = [&]( const char* endpoint, const endpoint_metrics& m, fc::optional<uint64_t> coalesced ) {
+            result.endpoints.emplace_back( endpoint_stats{ endpoint, m.total.get_summary(), m.fetch.get_summary(),
+                                                           m.decode.get_summary(), m.filter.get_summary(),
+                                                           m.docs_scanned, m.docs_returned, m.bytes_received, coalesced } );
+          };
+          add_endpoint( "get_actions", history->get_actions_metrics, history->actions_flights.get_stats().coalesced );
+          add_endpoint( "get_accounts_actions", history->get_accounts_actions_metrics, {} );
+          add_endpoint( "get_transaction", history->get_transaction_metrics, history->trx_flights.get_stats().coalesced );
+          add_endpoint( "get_key_accounts", history->get_key_accounts_metrics, {} );
+          add_endpoint( "get_controlled_accounts", history->get_controlled_accounts_metrics, {} );
+
+          auto add_cache = [&]( const char* cache, const auto& c ) {
+            if( !c ) return;
+            auto st = c->get_stats();
+            result.caches.emplace_back( cache_stats{ cache, st.entries, st.bytes, st.hits, st.misses, st.evictions, st.expirations } );
+          };
+          add_cache( "transaction", history->trx_cache );
+          add_cache( "actions", history->actions_cache );
+
+          result.pool = pool_stats{ history->pool_max_size, history->clients_in_use, history->clients_peak,
+                                    history->acquire_waits, history->acquire_timeouts };
+          if( const auto& f = history->account_filter ) {
+            result.account_filter = filter_stats{ history->account_filter_loaded, f->bit_count(), f->hash_count(),
+                                                  f->estimated_size(), history->account_filter_rejected };
+          }
+          return result;
+        }
+
     } /// mongo_history_apis
 
 } /// namespace eosio